@@ -0,0 +1,219 @@
+#include <cstdio>
+#include <deque>
+#include <mutex>
+#include <atomic>
+#include <thread>
+#include <condition_variable>
+#include <opencv2/opencv.hpp>
+#include "batch.h"
+#include "resample.h"
+#include "stream.h"
+
+using namespace std;
+using namespace cv;
+
+// images in flight between two stages
+#define BATCH_QUEUE_LEN 4
+
+// Fixed-capacity FIFO between pipeline stages: push() blocks while full,
+// pop() blocks while empty and fails once the queue is closed and drained.
+template<typename T>
+class BoundedQueue {
+public:
+    explicit BoundedQueue(size_t cap) : cap_(cap), closed_(false) {}
+
+    void push(const T &v) {
+        unique_lock<mutex> lock(m_);
+        notFull_.wait(lock, [this] { return q_.size() < cap_; });
+        q_.push_back(v);
+        notEmpty_.notify_one();
+    }
+
+    bool pop(T &v) {
+        unique_lock<mutex> lock(m_);
+        notEmpty_.wait(lock, [this] { return !q_.empty() || closed_; });
+        if(q_.empty())
+            return false;
+        v = q_.front();
+        q_.pop_front();
+        notFull_.notify_one();
+        return true;
+    }
+
+    void close() {
+        lock_guard<mutex> lock(m_);
+        closed_ = true;
+        notEmpty_.notify_all();
+    }
+
+private:
+    size_t cap_;
+    bool closed_;
+    deque<T> q_;
+    mutex m_;
+    condition_variable notFull_;
+    condition_variable notEmpty_;
+};
+
+// an image and its encoded bytes; buffers circulate between the stages
+// and keep their storage from one job to the next
+struct Buffer {
+    int job;
+    Mat img;
+    vector<uchar> bytes;
+};
+
+static double msSince(double t0) {
+    return ((double)getTickCount()-t0)*1000.0/getTickFrequency();
+}
+
+static bool readFile(const string &path, vector<uchar> &bytes) {
+    FILE *fp = fopen(path.c_str(), "rb");
+    if(!fp)
+        return false;
+    fseek(fp, 0, SEEK_END);
+    long n = ftell(fp);
+    fseek(fp, 0, SEEK_SET);
+    bool ok = n > 0;
+    if(ok) {
+        bytes.resize(n);
+        ok = fread(&bytes[0], 1, n, fp) == (size_t)n;
+    }
+    fclose(fp);
+    return ok;
+}
+
+static bool writeFile(const string &path, const vector<uchar> &bytes) {
+    FILE *fp = fopen(path.c_str(), "wb");
+    if(!fp)
+        return false;
+    bool ok = fwrite(&bytes[0], 1, bytes.size(), fp) == bytes.size();
+    return fclose(fp) == 0 && ok;
+}
+
+BatchStats runBatch(const vector<BatchJob> &jobs, int ioThreads) {
+    BatchStats st = BatchStats();
+    ioThreads = max(1, ioThreads);
+
+    // every stage can hold one buffer per thread besides the full queues
+    int nbufs = BATCH_QUEUE_LEN+ioThreads+1;
+    vector<Buffer> srcBufs(nbufs), dstBufs(nbufs);
+    BoundedQueue<Buffer*> freeSrc(nbufs), freeDst(nbufs);
+    BoundedQueue<Buffer*> decoded(BATCH_QUEUE_LEN), resized(BATCH_QUEUE_LEN);
+    for(int b = 0; b < nbufs; b++) {
+        freeSrc.push(&srcBufs[b]);
+        freeDst.push(&dstBufs[b]);
+    }
+
+    mutex statMutex;
+    atomic<int> nextJob(0), liveDecoders(ioThreads);
+    double t0 = (double)getTickCount();
+
+    // decode: read the file into reused bytes and decode into a reused Mat
+    vector<thread> decoders, encoders;
+    for(int d = 0; d < ioThreads; d++)
+        decoders.push_back(thread([&] {
+            double busy = 0;
+            int failed = 0;
+            for(;;) {
+                int j = nextJob++;
+                if(j >= (int)jobs.size())
+                    break;
+                Buffer *buf;
+                freeSrc.pop(buf);
+                double t = (double)getTickCount();
+                bool ok = readFile(jobs[j].input, buf->bytes);
+                if(ok) {
+                    imdecode(buf->bytes, -1, &buf->img);
+                    ok = buf->img.data != 0;
+                }
+                busy += msSince(t);
+                if(!ok) {
+                    printf("%s: cannot decode, skipped.\n", jobs[j].input.c_str());
+                    failed++;
+                    freeSrc.push(buf);
+                    continue;
+                }
+                buf->job = j;
+                decoded.push(buf);
+            }
+            lock_guard<mutex> lock(statMutex);
+            st.decodeMs += busy;
+            st.failed += failed;
+            if(--liveDecoders == 0)
+                decoded.close();
+        }));
+
+    // encode: compress into reused bytes and write them out
+    for(int e = 0; e < ioThreads; e++)
+        encoders.push_back(thread([&] {
+            double busy = 0, pixels = 0;
+            int done = 0, failed = 0;
+            Buffer *buf;
+            while(resized.pop(buf)) {
+                const BatchJob &job = jobs[buf->job];
+                string ext = outputExt(buf->img);
+                string name = job.outBase + ext;
+                double t = (double)getTickCount();
+                bool ok = imencode(ext, buf->img, buf->bytes) && writeFile(name, buf->bytes);
+                busy += msSince(t);
+                if(ok) {
+                    done++;
+                    pixels += (double)buf->img.rows*buf->img.cols;
+                }
+                else {
+                    printf("%s: cannot write, skipped.\n", name.c_str());
+                    failed++;
+                }
+                freeDst.push(buf);
+            }
+            lock_guard<mutex> lock(statMutex);
+            st.encodeMs += busy;
+            st.done += done;
+            st.failed += failed;
+            st.pixels += pixels;
+        }));
+
+    // resize on this thread, the work itself is spread over the resample
+    // pool; the tables are only rebuilt when size, scale or method change
+    Resampler rs;
+    Buffer *src;
+    while(decoded.pop(src)) {
+        const BatchJob &job = jobs[src->job];
+        if(!Resampler::supportsType(src->img.type())) {
+            printf("%s: unsupported image type, skipped.\n", job.input.c_str());
+            lock_guard<mutex> lock(statMutex);
+            st.failed++;
+        }
+        else {
+            double t = (double)getTickCount();
+            rs.init(src->img.size(), job.s, job.method);
+            st.resizeMs += msSince(t);
+            // an empty image cannot be encoded, imencode() would throw on
+            // the encoder thread
+            if(rs.dstSize().width == 0 || rs.dstSize().height == 0) {
+                printf("%s: scaled to an empty image, skipped.\n", job.input.c_str());
+                lock_guard<mutex> lock(statMutex);
+                st.failed++;
+            }
+            else {
+                Buffer *dst;
+                freeDst.pop(dst);
+                t = (double)getTickCount();
+                rs.run(src->img, dst->img);
+                st.resizeMs += msSince(t);
+                dst->job = src->job;
+                resized.push(dst);
+            }
+        }
+        freeSrc.push(src);
+    }
+    resized.close();
+
+    for(size_t i = 0; i < decoders.size(); i++)
+        decoders[i].join();
+    for(size_t i = 0; i < encoders.size(); i++)
+        encoders[i].join();
+    st.ms = msSince(t0);
+    return st;
+}
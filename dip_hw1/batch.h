@@ -0,0 +1,34 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+#include <string>
+#include <vector>
+
+// One line of a batch: resize input by s with method and write the result
+// to outBase plus the extension that suits it (see outputExt()).
+struct BatchJob {
+    std::string input;
+    std::string outBase;
+    double s;
+    int method;
+};
+
+struct BatchStats {
+    int done;
+    int failed;
+    double pixels;      // output pixels written
+    double ms;          // wall time
+    // busy time summed over the threads of each stage
+    double decodeMs;
+    double resizeMs;
+    double encodeMs;
+};
+
+// Decode, resize and encode as a pipeline: ioThreads decoder threads and
+// as many encoder threads run around the resize, which uses the shared
+// resample pool. The stages hand over through bounded queues and a fixed
+// set of image and byte buffers that are reused from job to job, so
+// memory stays flat however long the batch is.
+BatchStats runBatch(const std::vector<BatchJob> &jobs, int ioThreads);
+
+#endif
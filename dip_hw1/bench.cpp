@@ -0,0 +1,222 @@
+#include <cstdio>
+#include <cstring>
+#include <vector>
+#include <opencv2/opencv.hpp>
+#include "resample.h"
+
+using namespace std;
+using namespace cv;
+
+// larger outputs are skipped, 18x of a big source would not fit in memory
+#define BENCH_MAX_PIXELS (48*1000*1000)
+
+struct BenchMethod {
+    const char *name;
+    int method;
+    int (*resize)(Mat &srcMat, Mat &dstMat, double s);
+    int cvInter;
+};
+
+static const BenchMethod methods[] = {
+    { "bilinear", RESAMPLE_BILINEAR, myresize_l, INTER_LINEAR },
+    { "bicubic",  RESAMPLE_BICUBIC,  myresize_c, INTER_CUBIC },
+    { "area",     RESAMPLE_AREA,     myresize_a, INTER_AREA }
+};
+
+static void usage() {
+    printf("usage: resize_bench [--kernel=<k>] [--threads N] [--min-time S] [--out <file.json>]\n");
+    printf("<k>:\n\tscalar, sse, avx2 (default: best supported)\n");
+    printf("--threads N: worker threads for both resizes (default: all cores)\n");
+    printf("--min-time S: run each case for at least S seconds (default: 0.2)\n");
+    printf("--out: write the JSON there instead of stdout\n");
+}
+
+template<typename F>
+static double timeIt(F fn, double minTime, int &iters) {
+    // mean ms per call over at least minTime seconds, after one warm-up
+    fn();
+    double total = 0;
+    iters = 0;
+    while(total < minTime*1000 || iters < 3) {
+        double t0 = (double)getTickCount();
+        fn();
+        total += ((double)getTickCount()-t0)*1000.0/getTickFrequency();
+        iters++;
+    }
+    return total/iters;
+}
+
+static void boxTaps(int srcLen, int dstLen, double s, vector<int> &first, \
+    vector<vector<double> > &w) {
+    // dst pixel i covers [i/s, (i+1)/s) of the source, each source pixel
+    // weighs by the length it covers
+    first.resize(dstLen);
+    w.resize(dstLen);
+    for(int i = 0; i < dstLen; i++) {
+        double x0 = i/s, x1 = min((i+1)/s, (double)srcLen);
+        first[i] = cvFloor(x0);
+        w[i].clear();
+        for(int sx = first[i]; sx < x1; sx++)
+            w[i].push_back((min(sx+1.0, x1)-max((double)sx, x0))/(x1-x0));
+    }
+}
+
+static Mat boxReference(const Mat &src, double s, Size dsize) {
+    // exact area average in double, rows then columns
+    int cn = src.channels();
+    vector<int> fx, fy;
+    vector<vector<double> > wx, wy;
+    boxTaps(src.cols, dsize.width, s, fx, wx);
+    boxTaps(src.rows, dsize.height, s, fy, wy);
+
+    Mat src64, tmp(src.rows, dsize.width, CV_64FC(cn));
+    Mat dst64(dsize, CV_64FC(cn), Scalar::all(0));
+    src.convertTo(src64, CV_64F);
+    for(int y = 0; y < src.rows; y++) {
+        const double *sp = src64.ptr<double>(y);
+        double *tp = tmp.ptr<double>(y);
+        for(int i = 0; i < dsize.width; i++)
+            for(int c = 0; c < cn; c++) {
+                double v = 0;
+                for(size_t t = 0; t < wx[i].size(); t++)
+                    v += wx[i][t]*sp[(fx[i]+t)*cn+c];
+                tp[i*cn+c] = v;
+            }
+    }
+    for(int i = 0; i < dsize.height; i++) {
+        double *dp = dst64.ptr<double>(i);
+        for(size_t t = 0; t < wy[i].size(); t++) {
+            const double *tp = tmp.ptr<double>(fy[i]+(int)t);
+            for(int k = 0; k < dsize.width*cn; k++)
+                dp[k] += wy[i][t]*tp[k];
+        }
+    }
+    Mat dst;
+    dst64.convertTo(dst, src.type());
+    return dst;
+}
+
+static Mat reference(const Mat &src, const BenchMethod &m, double s, Size dsize) {
+    // cv::resize centers its pixels ((i+0.5)/s-0.5) while we map i to i/s,
+    // so for accuracy the same kernels are run through warpAffine with our
+    // mapping. INTER_AREA with a dsize scales by src/dsize rather than 1/s,
+    // so area averaging is checked against the exact box integral instead
+    if(m.method == RESAMPLE_AREA && s < 1)
+        return boxReference(src, s, dsize);
+    Mat dst;
+    int inter = m.method == RESAMPLE_BICUBIC ? INTER_CUBIC : INTER_LINEAR;
+    Mat M = (Mat_<double>(2, 3) << 1/s, 0, 0, 0, 1/s, 0);
+    warpAffine(src, dst, M, dsize, inter | WARP_INVERSE_MAP, BORDER_REPLICATE);
+    return dst;
+}
+
+int main(int argc, char** argv) {
+    int kernel = RESAMPLE_KERNEL_AUTO;
+    int threads = 0;
+    double minTime = 0.2;
+    const char *out = 0;
+    for(int a = 1; a < argc; a++) {
+        if(!strcmp(argv[a], "--threads") && a+1 < argc)
+            threads = atoi(argv[++a]);
+        else if(!strcmp(argv[a], "--min-time") && a+1 < argc)
+            minTime = atof(argv[++a]);
+        else if(!strcmp(argv[a], "--out") && a+1 < argc)
+            out = argv[++a];
+        else if(!strncmp(argv[a], "--kernel=", 9)) {
+            kernel = parseResampleKernel(argv[a]+9);
+            if(kernel == -2) {
+                usage();
+                return -1;
+            }
+        }
+        else {
+            usage();
+            return -1;
+        }
+    }
+
+    kernel = setResampleKernel(kernel);
+    setResampleThreads(threads);
+    // same number of threads on both sides
+    setNumThreads(getResampleThreads());
+
+    FILE *fp = out ? fopen(out, "w") : stdout;
+    if(!fp) {
+        printf("Cannot write %s.\n", out);
+        return -1;
+    }
+
+    // google-benchmark style layout: run context, then one entry per case
+    fprintf(fp, "{\n  \"context\": {\n");
+    fprintf(fp, "    \"kernel\": \"%s\",\n", resampleKernelName(kernel));
+    fprintf(fp, "    \"threads\": %d,\n", getResampleThreads());
+    fprintf(fp, "    \"opencv_version\": \"%s\",\n", CV_VERSION);
+    fprintf(fp, "    \"min_time\": %g\n  },\n", minTime);
+    fprintf(fp, "  \"benchmarks\": [");
+
+    const Size sizes[] = { Size(64, 48), Size(640, 480), Size(1920, 1080) };
+    const int channels[] = { 1, 3, 4 };
+    const double scales[] = { 0.3, 3.0, 18 };
+    bool first = true;
+
+    for(size_t z = 0; z < sizeof(sizes)/sizeof(sizes[0]); z++)
+    for(size_t c = 0; c < sizeof(channels)/sizeof(channels[0]); c++) {
+        Mat src(sizes[z], CV_8UC(channels[c]));
+        randu(src, Scalar::all(0), Scalar::all(256));
+
+        for(size_t k = 0; k < sizeof(scales)/sizeof(scales[0]); k++)
+        for(size_t m = 0; m < sizeof(methods)/sizeof(methods[0]); m++) {
+            const BenchMethod &bm = methods[m];
+            double s = scales[k];
+            Size dsize(cvFloor(src.cols*s), cvFloor(src.rows*s));
+            if((double)dsize.width*dsize.height > BENCH_MAX_PIXELS)
+                continue;
+
+            // ours includes building the tables, as cv::resize does
+            Mat dst, cvDst;
+            int iters, cvIters;
+            double ms = timeIt([&] { bm.resize(src, dst, s); }, minTime, iters);
+            double cvMs = timeIt([&] { resize(src, cvDst, dsize, 0, 0, bm.cvInter); }, \
+                minTime, cvIters);
+
+            // accuracy against the reference, over all samples
+            Mat diff;
+            absdiff(dst, reference(src, bm, s, dsize), diff);
+            double maxDiff;
+            minMaxLoc(diff.reshape(1), 0, &maxDiff);
+            double meanDiff = mean(diff.reshape(1))[0];
+
+            char name[64];
+            snprintf(name, sizeof(name), "%s/%dx%d/c%d/s%g", bm.name, src.cols, src.rows, \
+                channels[c], s);
+            double pixels = (double)dsize.width*dsize.height;
+            double bytes = (double)src.total()*src.elemSize()+dst.total()*dst.elemSize();
+            fprintf(fp, "%s\n    {\n", first ? "" : ",");
+            fprintf(fp, "      \"name\": \"%s\",\n", name);
+            fprintf(fp, "      \"method\": \"%s\",\n", bm.name);
+            fprintf(fp, "      \"width\": %d,\n      \"height\": %d,\n", src.cols, src.rows);
+            fprintf(fp, "      \"channels\": %d,\n      \"scale\": %g,\n", channels[c], s);
+            fprintf(fp, "      \"dst_width\": %d,\n      \"dst_height\": %d,\n", dsize.width, dsize.height);
+            fprintf(fp, "      \"iterations\": %d,\n", iters);
+            fprintf(fp, "      \"real_time_ms\": %.6f,\n", ms);
+            fprintf(fp, "      \"ns_per_pixel\": %.4f,\n", ms*1e6/pixels);
+            fprintf(fp, "      \"gb_per_s\": %.4f,\n", bytes/(ms*1e6));
+            fprintf(fp, "      \"cv_iterations\": %d,\n", cvIters);
+            fprintf(fp, "      \"cv_real_time_ms\": %.6f,\n", cvMs);
+            fprintf(fp, "      \"cv_ns_per_pixel\": %.4f,\n", cvMs*1e6/pixels);
+            fprintf(fp, "      \"speedup\": %.4f,\n", cvMs/ms);
+            fprintf(fp, "      \"max_abs_diff\": %g,\n", maxDiff);
+            fprintf(fp, "      \"mean_abs_diff\": %.6f\n    }", meanDiff);
+            fflush(fp);
+            first = false;
+
+            // progress on stderr, stdout may be the JSON
+            fprintf(stderr, "%-28s %9.3f ns/px %8.3f GB/s  x%.2f vs cv  diff max %g mean %.4f\n", \
+                name, ms*1e6/pixels, bytes/(ms*1e6), cvMs/ms, maxDiff, meanDiff);
+        }
+    }
+    fprintf(fp, "\n  ]\n}\n");
+    if(out)
+        fclose(fp);
+    return 0;
+}
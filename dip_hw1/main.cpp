@@ -1,173 +1,339 @@
 #include <cstdio>
+#include <cstdlib>
 #include <string>
 #include <cassert>
+#include <cstring>
+#include <memory>
+#include <fstream>
+#include <sstream>
 #include <opencv2/opencv.hpp>
+#include "resample.h"
+#include "stream.h"
+#include "batch.h"
 
 using namespace std;
 using namespace cv;
 
 void printMat(Mat &mat);
-int bilinear(uchar p[2][2], double x, double y);
-int bicubic(uchar p[4][4], double x, double y);
-int myresize_l(Mat &srcMat, Mat &dstMat, double s);
-int myresize_c(Mat &srcMat, Mat &dstMat, double s);
 
-int main(int argc, char** argv) {
-    if (argc != 4) {
-        printf("usage: main.out <image_path> <scaling_factor> <option>\n");
-        printf("<option>:\n\t0: bilinear inter.\n\t1: bicubic inter.\n");
-        return -1;
+static void usage() {
+    printf("usage: main.out <image_path> <scaling_factor> <option> [--kernel=<k>] [--threads N] [--scaling] [--stream]\n");
+    printf("       main.out --glob <pattern|dir> <scaling_factor> <option> [--io-threads N] [...]\n");
+    printf("       main.out --batch <manifest> [--io-threads N] [...]\n");
+    printf("<option>:\n\t0: bilinear inter.\n\t1: bicubic inter.\n\t2: area average\n"
+        "\t3: mip pyramid of area averaged 1/2, 1/4, ... levels down to <scaling_factor>\n");
+    printf("<k>:\n\tscalar, sse, avx2 (default: best supported)\n");
+    printf("--threads N: worker threads (default: all cores)\n");
+    printf("--scaling: time 1, 2, 4, ... N threads and report the efficiency\n");
+    printf("--stream: bounded-memory resize to a PPM/PGM, reads PPM/PGM input row by row\n");
+    printf("--glob: resize every image matching the pattern in one pipelined batch\n");
+    printf("--batch: same for the lines \"<image_path> <scaling_factor> <option>\" of a manifest\n");
+    printf("--io-threads N: decoder and encoder threads each in a batch (default: 2)\n");
+}
+
+typedef int (*ResizeFunc)(Mat &srcMat, Mat &dstMat, double s);
+
+// resize function and output name suffix for each <option>
+static const ResizeFunc resizeFuncs[] = { myresize_l, myresize_c, myresize_a };
+static const char *methodSuffix[] = { "_l", "_c", "_a" };
+
+static string outputBase(const string &path, const string &scale, int opt) {
+    return path.substr(0, path.find_last_of(".")) + "_" + scale + methodSuffix[opt];
+}
+
+static double timeResize(Mat &srcMat, Mat &dstMat, double s, int opt) {
+    // best of 3 runs, in ms
+    double best = 0;
+    for(int r = 0; r < 3; r++) {
+        double t0 = (double)getTickCount();
+        resizeFuncs[opt](srcMat, dstMat, s);
+        double ms = ((double)getTickCount()-t0)*1000.0/getTickFrequency();
+        if(r == 0 || ms < best)
+            best = ms;
     }
+    return best;
+}
 
-    int i, j, k;
-    Mat srcMat;
+static void reportScaling(Mat &srcMat, double s, int opt, int maxThreads) {
     Mat dstMat;
-    srcMat = imread(argv[1], 1);
+    double base = 0;
+    printf("threads  time(ms)  speedup  efficiency\n");
+    // 1, 2, 4, ... and maxThreads itself
+    for(int n = 1; ; n = min(n*2, maxThreads)) {
+        setResampleThreads(n);
+        double ms = timeResize(srcMat, dstMat, s, opt);
+        if(n == 1)
+            base = ms;
+        printf("%7d  %8.2f  %7.2f  %9.1f%%\n", n, ms, base/ms, 100.0*base/(ms*n));
+        if(n == maxThreads)
+            break;
+    }
+    setResampleThreads(maxThreads);
+}
 
-    if (!srcMat.data) {
-        printf("Image data does not exist.\n");
-        return -1;
+static int streamResize(const char *path, const char *scale, double s, int opt) {
+    // netpbm input is read row by row, other formats are decoded first;
+    // the output is never held in full either way
+    string fullname = path;
+    unique_ptr<RowSource> src;
+    if(isPnmPath(fullname)) {
+        PnmReader *pnm = new PnmReader;
+        src.reset(pnm);
+        if(!pnm->open(fullname)) {
+            printf("Cannot read %s as 8/16-bit PGM/PPM.\n", path);
+            return -1;
+        }
     }
-    
-    string fullname = argv[1];
-    if(!atoi(argv[3])) {
-        // bilinear interpolation
-        myresize_l(srcMat, dstMat, atof(argv[2]));
-        //resize(srcMat, dstMat, cv::Size(srcMat.cols*atof(argv[2]),srcMat.rows*atof(argv[2])));
-        
-        string newname = fullname.substr(0, fullname.find_last_of(".")) + "_" +\
-            argv[2] + "_l" + ".jpg";
-        imwrite(newname, dstMat);
+    else {
+        Mat srcMat = imread(path, -1);
+        if (!srcMat.data) {
+            printf("Image data does not exist.\n");
+            return -1;
+        }
+        if((srcMat.depth() != CV_8U && srcMat.depth() != CV_16U) || \
+            (srcMat.channels() != 1 && srcMat.channels() != 3)) {
+            printf("--stream needs an 8 or 16-bit gray or color image.\n");
+            return -1;
+        }
+        src.reset(new MatRowSource(srcMat));
     }
-    
-    if(atoi(argv[3])) {
-        // bicubic interpolation
-        myresize_c(srcMat, dstMat, atof(argv[2]));
-        //resize(srcMat, dstMat, cv::Size(srcMat.cols*atof(argv[2]),srcMat.rows*atof(argv[2])), INTER_CUBIC);
-        
-        string newname = fullname.substr(0, fullname.find_last_of(".")) + "_" +\
-            argv[2] + "_c" + ".jpg";
-        imwrite(newname, dstMat);
+
+    Resampler rs;
+    rs.init(Size(src->cols, src->rows), s, opt);
+
+    string newname = outputBase(fullname, scale, opt) + (src->channels == 3 ? ".ppm" : ".pgm");
+    PnmWriter dst;
+    if(!dst.open(newname, rs.dstSize().height, rs.dstSize().width, src->channels, src->depth)) {
+        printf("Cannot write %s.\n", newname.c_str());
+        return -1;
     }
-    
+
+    double t0 = (double)getTickCount();
+    bool ok = rs.runStream(*src, dst) && dst.close();
+    double ms = ((double)getTickCount()-t0)*1000.0/getTickFrequency();
+    if(!ok) {
+        printf("Streaming resize failed.\n");
+        return -1;
+    }
+
+    printf("%s, %d threads, streamed: %.2f ms, %.1f MP/s\n", \
+        resampleKernelName(rs.kernel()), getResampleThreads(), ms, \
+        (double)rs.dstSize().width*rs.dstSize().height/(ms*1000.0));
     return 0;
 }
 
-int myresize_l(Mat &srcMat, Mat &dstMat, double s) {
-    // create dstMat by scaling factor s 
-    dstMat.create(cvFloor(srcMat.rows*s), cvFloor(srcMat.cols*s), srcMat.type());
-        
-    int i, j, k;
-    // where 'i' for rows, 'j' for cols (in dstMat),
-    // 'k' for channels
-    for(i = 0; i < dstMat.rows; i++) {
-        // find the nearest point sx in srcMat
-        double delx = (double)i/s;
-        int sx = cvFloor(delx);
-        delx -= sx; // where delx is the dist. from sx
-        
-        for(j = 0; j < dstMat.cols; j++) {  
-            // for each (i, j) in dstMat
-            // find corresponding 2x2 grid in scrMat [sx,sx+1]x[sy,sy+1]
-            double dely = (double)j/s;
-            int sy = cvFloor(dely);
-            dely -= sy;
-            
-            // shift points by sx, sy
-            // we have (delx, dely) in [0,1]x[0,1]
-            for(k = 0; k < dstMat.channels(); k++) {
-                uchar p[2][2];
-                p[0][0] = srcMat.at<Vec3b>(sx, sy)[k];
-                p[1][0] = srcMat.at<Vec3b>(sx+(sx<srcMat.rows-1), sy)[k];
-                p[0][1] = srcMat.at<Vec3b>(sx, sy+(sy<srcMat.cols-1))[k];
-                p[1][1] = srcMat.at<Vec3b>(sx+(sx<srcMat.rows-1), sy+(sy<srcMat.cols-1))[k];
-                dstMat.at<Vec3b>(i, j)[k] = bilinear(p, delx, dely); 
-            
-            }
-        }
+static double writePyramid(Mat &srcMat, const string &fullname, double s, double &pixels) {
+    // each level is the area average of the previous one at 1/2, so the
+    // source is traversed once and every level costs a quarter of the last;
+    // stops at the first level smaller than s (a tiny s goes down to 1x1).
+    // Sizes round up like pyrDown, (w+1)/2: on an odd side the last pixel
+    // averages the last source pixel alone, so no pixel is dropped
+    Resampler rs;
+    string base = fullname.substr(0, fullname.find_last_of("."));
+    Mat level[2];
+    const Mat *prev = &srcMat;
+    double scale = 1, ms = 0;
+    for(int k = 1; prev->cols > 1 || prev->rows > 1; k++) {
+        scale *= 0.5;
+        if(scale < s)
+            break;
+        Mat &cur = level[k&1];
+        rs.init(prev->size(), 0.5, RESAMPLE_AREA, true);
+
+        double t0 = (double)getTickCount();
+        rs.run(*prev, cur);
+        ms += ((double)getTickCount()-t0)*1000.0/getTickFrequency();
+        pixels += (double)cur.rows*cur.cols;
+
+        char name[32];
+        sprintf(name, "_mip%d", k);
+        imwrite(base + name + outputExt(cur), cur);
+        prev = &cur;
     }
-    return 1;
+    return ms;
 }
 
-int myresize_c(Mat &srcMat_o, Mat &dstMat, double s) {
-    // create dstMat by scaling factor s 
-    dstMat.create(cvFloor(srcMat_o.rows*s), cvFloor(srcMat_o.cols*s), \
-        srcMat_o.type());
-    
-    // expand the boarder for convolution
-    Mat srcMat;
-    copyMakeBorder(srcMat_o, srcMat, 1, 2, 1, 2, BORDER_REPLICATE);
-    
-    int i, j, k;
-    for(i = 0; i < dstMat.rows; i++) {
-        // find the nearest point sx in srcMat
-        double delx = (double)i/s;
-        int sx = cvFloor(delx);
-        delx -= sx; // where delx is the dist. from sx
-        
-        for(j = 0; j < dstMat.cols; j++) {
-            // for each (i, j) in dstMat
-            // find corresponding 4x4 grid in scrMat [sx-1,sx+2]x[sy-1,sy+2]
-            double dely = (double)j/s;
-            int sy = cvFloor(dely);
-            dely -= sy;
-            
-            for(k = 0; k < dstMat.channels(); k++) {
-                uchar p[4][4];                
-                
-                for(int l = 0; l < 4; l++)
-                    for(int m = 0; m < 4; m++) 
-                        //p[l][m] = srcMat.at<Vec3b>(sx+l-1, sy+m-1)[k];
-                        p[l][m] = srcMat.at<Vec3b>(sx+l, sy+m)[k];
-                dstMat.at<Vec3b>(i, j)[k] = bicubic(p, delx, dely);
-            }
+// a scaling factor is a number > 0; anything else would make a negative
+// size in Resampler::init()
+static bool parseScale(const string &text, double &s) {
+    char *end;
+    s = strtod(text.c_str(), &end);
+    return end != text.c_str() && *end == 0 && s > 0;
+}
+
+static bool readManifest(const char *path, vector<BatchJob> &jobs) {
+    // one "<image_path> <scaling_factor> <option>" per line, # comments
+    ifstream in(path);
+    if(!in)
+        return false;
+    string line;
+    for(int n = 1; getline(in, line); n++) {
+        istringstream ls(line);
+        BatchJob job;
+        string scale;
+        if(!(ls >> job.input) || job.input[0] == '#')
+            continue;
+        if(!(ls >> scale >> job.method) || !parseScale(scale, job.s) || \
+            job.method < RESAMPLE_BILINEAR || job.method > RESAMPLE_AREA) {
+            printf("%s:%d: expected <image_path> <scaling_factor > 0> <option 0-2>\n", path, n);
+            return false;
         }
+        job.outBase = outputBase(job.input, scale, job.method);
+        jobs.push_back(job);
     }
-    
-    // cut duplicate part
-    //dstMat.rows -= 2*s;
-    //dstMat.cols -= 2*s;
-    
-    return 1;
+    return true;
 }
 
-int bilinear(uchar p[2][2], double x, double y) {
-    // interpolate (x,y) on grid [0,1]x[0,1]
-    assert(x>=0 && x<1 && y>=0 && y<1);
-    return (1-x)*(1-y)*p[0][0]+x*(1-y)*p[1][0]+\
-        (1-x)*y*p[0][1]+x*y*p[1][1];
+static int batchResize(const vector<BatchJob> &jobs, int ioThreads) {
+    if(jobs.empty()) {
+        printf("No images to resize.\n");
+        return -1;
+    }
+
+    BatchStats st = runBatch(jobs, ioThreads);
+    printf("%d images (%d failed) in %.2f ms: %.1f images/s, %.1f MP/s\n", \
+        st.done, st.failed, st.ms, st.done*1000.0/st.ms, st.pixels/(st.ms*1000.0));
+    printf("busy ms, decode %.1f (%d threads), resize %.1f (%d threads), encode %.1f (%d threads)\n", \
+        st.decodeMs, ioThreads, st.resizeMs, getResampleThreads(), st.encodeMs, ioThreads);
+    return st.failed ? -1 : 0;
 }
 
-int bicubic(uchar p[4][4], double x, double y){
-    // interpolate (x,y) on grid [-1,2]x[-1,2]
-    assert(x>=0 && x<1 && y>=0 && y<1);
-    
-    // use kernel convolution to perform cubic interpolation
-    double wx[4], wy[4];
-    double a = -0.75f;
-    
-    wx[0] = ((a*(x+1)-5*a)*(x+1)+8*a)*(x+1)-4*a;
-    wx[1] = ((a+2)*x-(a+3))*x*x+1;
-    wx[2] = ((a+2)*(1-x)-(a+3))*(1-x)*(1-x)+1;
-    wx[3] = ((a*(2-x)-5*a)*(2-x)+8*a)*(2-x)-4*a;
-    
-    wy[0] = ((a*(y+1)-5*a)*(y+1)+8*a)*(y+1)-4*a;
-    wy[1] = ((a+2)*y-(a+3))*y*y+1;
-    wy[2] = ((a+2)*(1-y)-(a+3))*(1-y)*(1-y)+1;
-    wy[3] = ((a*(2-y)-5*a)*(2-y)+8*a)*(2-y)-4*a;
+int main(int argc, char** argv) {
+    // split options from the positional arguments
+    char *args[3];
+    int nargs = 0;
+    int kernel = RESAMPLE_KERNEL_AUTO;
+    int threads = 0;
+    bool scaling = false;
+    bool stream = false;
+    bool globMode = false;
+    const char *manifest = 0;
+    int ioThreads = 2;
+    for(int a = 1; a < argc; a++) {
+        if(!strcmp(argv[a], "--threads") && a+1 < argc)
+            threads = atoi(argv[++a]);
+        else if(!strcmp(argv[a], "--io-threads") && a+1 < argc)
+            ioThreads = atoi(argv[++a]);
+        else if(!strcmp(argv[a], "--batch") && a+1 < argc)
+            manifest = argv[++a];
+        else if(!strcmp(argv[a], "--glob"))
+            globMode = true;
+        else if(!strcmp(argv[a], "--scaling"))
+            scaling = true;
+        else if(!strcmp(argv[a], "--stream"))
+            stream = true;
+        else if(!strncmp(argv[a], "--kernel=", 9)) {
+            kernel = parseResampleKernel(argv[a]+9);
+            if(kernel == -2) {
+                usage();
+                return -1;
+            }
+        }
+        else if(nargs < 3)
+            args[nargs++] = argv[a];
+        else
+            nargs++;
+    }
+
+    if (nargs != (manifest ? 0 : 3)) {
+        usage();
+        return -1;
+    }
+
+    int used = setResampleKernel(kernel);
+    if(kernel != RESAMPLE_KERNEL_AUTO && used != kernel)
+        printf("kernel %s not supported, using %s\n", resampleKernelName(kernel), \
+            resampleKernelName(used));
+    setResampleThreads(threads);
+
+    vector<BatchJob> jobs;
+    if(manifest) {
+        if(!readManifest(manifest, jobs)) {
+            printf("Cannot read the manifest %s.\n", manifest);
+            return -1;
+        }
+        return batchResize(jobs, ioThreads);
+    }
+
+    int opt = atoi(args[2]);
+    if(opt < RESAMPLE_BILINEAR || opt > RESAMPLE_AREA+1) {
+        usage();
+        return -1;
+    }
+    double scale;
+    if(!parseScale(args[1], scale)) {
+        printf("The scaling factor must be a number > 0.\n");
+        return -1;
+    }
+    if(globMode) {
+        if(opt > RESAMPLE_AREA) {
+            printf("A batch writes one image per input, it cannot make pyramids.\n");
+            return -1;
+        }
+        vector<String> paths;
+        cv::glob(args[0], paths);
+        for(size_t i = 0; i < paths.size(); i++) {
+            BatchJob job;
+            job.input = paths[i];
+            job.s = scale;
+            job.method = opt;
+            job.outBase = outputBase(job.input, args[1], opt);
+            jobs.push_back(job);
+        }
+        return batchResize(jobs, ioThreads);
+    }
+    if(stream) {
+        if(opt > RESAMPLE_AREA) {
+            printf("--stream writes a single image, it cannot make a pyramid.\n");
+            return -1;
+        }
+        return streamResize(args[0], args[1], scale, opt);
+    }
+
+    Mat srcMat;
+    Mat dstMat;
+    // keep depth and channels as stored: gray, BGRA, 16-bit and float
+    // images are resized as they are
+    srcMat = imread(args[0], -1);
+
+    if (!srcMat.data) {
+        printf("Image data does not exist.\n");
+        return -1;
+    }
+    if (!Resampler::supportsType(srcMat.type())) {
+        printf("Unsupported image type: 1, 3 or 4 channels of 8U, 16U, 16S or 32F.\n");
+        return -1;
+    }
     
-    int conv = cvFloor(((double)p[0][0]*wx[0]+(double)p[1][0]*wx[1]+ \
-        (double)p[2][0]*wx[2]+(double)p[3][0]*wx[3])*wy[0]+ \
-        ((double)p[0][1]*wx[0]+(double)p[1][1]*wx[1]+ \
-        (double)p[2][1]*wx[2]+(double)p[3][1]*wx[3])*wy[1]+ \
-        ((double)p[0][2]*wx[0]+(double)p[1][2]*wx[1]+ \
-        (double)p[2][2]*wx[2]+(double)p[3][2]*wx[3])*wy[2]+ \
-        ((double)p[0][3]*wx[0]+(double)p[1][3]*wx[1]+ \
-        (double)p[2][3]*wx[2]+(double)p[3][3]*wx[3])*wy[3]);
+    if(scaling && opt <= RESAMPLE_AREA)
+        reportScaling(srcMat, scale, opt, getResampleThreads());
+
+    string fullname = args[0];
+    double ms = 0, pixels = 0;
+    if(opt <= RESAMPLE_AREA) {
+        // 0: bilinear, 1: bicubic, 2: area interpolation
+        double t0 = (double)getTickCount();
+        resizeFuncs[opt](srcMat, dstMat, scale);
+        ms = ((double)getTickCount()-t0)*1000.0/getTickFrequency();
+        pixels = dstMat.rows*(double)dstMat.cols;
+        if(dstMat.empty()) {
+            printf("The scaling factor gives an empty image.\n");
+            return -1;
+        }
+        
+        string newname = outputBase(fullname, args[1], opt) + outputExt(dstMat);
+        imwrite(newname, dstMat);
+    }
+    else {
+        // 3: mip pyramid, the throughput below counts all levels
+        ms = writePyramid(srcMat, fullname, scale, pixels);
+    }
     
-    // some results could be out of boundary
-    if(conv > 255) conv = 255;
-    return abs(conv);
+    // resize throughput, for A/B of the kernels
+    printf("%s, %d threads: %.2f ms, %.1f MP/s\n", resampleKernelName(used), \
+        getResampleThreads(), ms, pixels/(ms*1000.0));
+
+    return 0;
 }
 
 void printMat(Mat &mat){
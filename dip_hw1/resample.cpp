@@ -0,0 +1,487 @@
+#include <cmath>
+#include <cassert>
+#include <cstring>
+#include <algorithm>
+#include "resample.h"
+#include "resample_kernels.h"
+#include "threadpool.h"
+#include "stream.h"
+
+using namespace std;
+using namespace cv;
+
+// bytes of cached horizontal rows per tile, about half of a typical L2
+#define RESAMPLE_TILE_BYTES (128*1024)
+
+static int defaultKernel = RESAMPLE_KERNEL_AUTO;
+static ThreadPool *pool = 0;
+
+void setResampleThreads(int nthreads) {
+    if(nthreads <= 0)
+        nthreads = max(1, (int)thread::hardware_concurrency());
+    if(pool && pool->size() == nthreads)
+        return;
+    delete pool;
+    pool = new ThreadPool(nthreads);
+}
+
+int getResampleThreads() {
+    if(!pool)
+        setResampleThreads(0);
+    return pool->size();
+}
+
+bool resampleKernelSupported(int kernel) {
+    switch(kernel) {
+    case RESAMPLE_KERNEL_SCALAR:
+        return true;
+#ifdef RESAMPLE_HAVE_SSE41
+    case RESAMPLE_KERNEL_SSE:
+        return __builtin_cpu_supports("sse4.1");
+#endif
+#ifdef RESAMPLE_HAVE_AVX2
+    case RESAMPLE_KERNEL_AVX2:
+        return __builtin_cpu_supports("avx2");
+#endif
+    default:
+        return false;
+    }
+}
+
+const char* resampleKernelName(int kernel) {
+    switch(kernel) {
+    case RESAMPLE_KERNEL_SCALAR: return "scalar";
+    case RESAMPLE_KERNEL_SSE:    return "sse";
+    case RESAMPLE_KERNEL_AVX2:   return "avx2";
+    default:                     return "auto";
+    }
+}
+
+int parseResampleKernel(const char *name) {
+    if(!strcmp(name, "scalar")) return RESAMPLE_KERNEL_SCALAR;
+    if(!strcmp(name, "sse"))    return RESAMPLE_KERNEL_SSE;
+    if(!strcmp(name, "avx2"))   return RESAMPLE_KERNEL_AVX2;
+    if(!strcmp(name, "auto"))   return RESAMPLE_KERNEL_AUTO;
+    return -2;
+}
+
+static int bestKernel() {
+    if(resampleKernelSupported(RESAMPLE_KERNEL_AVX2))
+        return RESAMPLE_KERNEL_AVX2;
+    if(resampleKernelSupported(RESAMPLE_KERNEL_SSE))
+        return RESAMPLE_KERNEL_SSE;
+    return RESAMPLE_KERNEL_SCALAR;
+}
+
+int setResampleKernel(int kernel) {
+    // unsupported requests fall back to the best one we have
+    if(kernel == RESAMPLE_KERNEL_AUTO || !resampleKernelSupported(kernel))
+        kernel = bestKernel();
+    defaultKernel = kernel;
+    return kernel;
+}
+
+int getResampleKernel() {
+    if(defaultKernel == RESAMPLE_KERNEL_AUTO)
+        defaultKernel = bestKernel();
+    return defaultKernel;
+}
+
+static VResizeFunc vresizeFunc(int kernel) {
+    switch(kernel) {
+#ifdef RESAMPLE_HAVE_SSE41
+    case RESAMPLE_KERNEL_SSE:  return vresize_sse41;
+#endif
+#ifdef RESAMPLE_HAVE_AVX2
+    case RESAMPLE_KERNEL_AVX2: return vresize_avx2;
+#endif
+    default:                   return vresize_scalar;
+    }
+}
+
+static void cubicWeights(double x, double w[4]) {
+    // kernel convolution weights for the 4 taps at -1, 0, 1, 2
+    double a = -0.75f;
+
+    w[0] = ((a*(x+1)-5*a)*(x+1)+8*a)*(x+1)-4*a;
+    w[1] = ((a+2)*x-(a+3))*x*x+1;
+    w[2] = ((a+2)*(1-x)-(a+3))*(1-x)*(1-x)+1;
+    w[3] = ((a*(2-x)-5*a)*(2-x)+8*a)*(2-x)-4*a;
+}
+
+void AxisTable::convertWeights(int i) {
+    const double *wp = &w[i*ntaps];
+    for(int t = 0; t < ntaps; t++)
+        wf[i*ntaps+t] = (float)wp[t];
+
+    // fixed-point weights, rounded so that they still sum to one
+    short *fp = &wfix[i*ntaps];
+    int sum = 0, big = 0;
+    for(int t = 0; t < ntaps; t++) {
+        fp[t] = (short)cvRound(wp[t]*(1 << RESAMPLE_WBITS));
+        sum += fp[t];
+        if(wp[t] > wp[big])
+            big = t;
+    }
+    fp[big] += (1 << RESAMPLE_WBITS)-sum;
+}
+
+void AxisTable::buildArea(int srcLen, int dstLen, double s) {
+    // dst pixel i covers [i/s, (i+1)/s) of the source; each source pixel
+    // it touches weighs by the length it covers
+    const double eps = 1e-9;
+    ntaps = 2;
+    for(int i = 0; i < dstLen; i++) {
+        double x0 = i/s, x1 = min((i+1)/s, (double)srcLen);
+        int n = (int)ceil(x1-eps)-cvFloor(x0+eps);
+        ntaps = max(ntaps, (n+1)&~1);
+    }
+
+    idx.resize(dstLen*ntaps);
+    w.resize(dstLen*ntaps);
+    wfix.resize(dstLen*ntaps);
+    wf.resize(dstLen*ntaps);
+
+    for(int i = 0; i < dstLen; i++) {
+        double x0 = i/s, x1 = min((i+1)/s, (double)srcLen);
+        int sx0 = cvFloor(x0+eps), sx1 = (int)ceil(x1-eps);
+        int *ip = &idx[i*ntaps];
+        double *wp = &w[i*ntaps];
+
+        for(int t = 0; t < ntaps; t++) {
+            int sx = sx0+t;
+            if(sx < sx1) {
+                ip[t] = sx;
+                wp[t] = (min(sx+1.0, x1)-max((double)sx, x0))/(x1-x0);
+            }
+            else {
+                // padding repeats the last tap with no weight
+                ip[t] = sx1-1;
+                wp[t] = 0;
+            }
+        }
+        convertWeights(i);
+    }
+}
+
+void AxisTable::build(int srcLen, int dstLen, double s, int method) {
+    // area averaging only differs from bilinear when shrinking
+    if(method == RESAMPLE_AREA && s < 1) {
+        buildArea(srcLen, dstLen, s);
+        return;
+    }
+
+    ntaps = (method == RESAMPLE_BICUBIC) ? 4 : 2;
+    idx.resize(dstLen*ntaps);
+    w.resize(dstLen*ntaps);
+    wfix.resize(dstLen*ntaps);
+    wf.resize(dstLen*ntaps);
+
+    for(int i = 0; i < dstLen; i++) {
+        // find the nearest point sx in source
+        double del = (double)i/s;
+        int sx = cvFloor(del);
+        del -= sx; // where del is the dist. from sx
+
+        int *ip = &idx[i*ntaps];
+        double *wp = &w[i*ntaps];
+        if(method == RESAMPLE_BICUBIC) {
+            // taps [sx-1,sx+2], replicated at the border
+            for(int t = 0; t < 4; t++)
+                ip[t] = min(max(sx+t-1, 0), srcLen-1);
+            cubicWeights(del, wp);
+        }
+        else {
+            // taps [sx,sx+1], the last one repeats itself
+            ip[0] = sx;
+            ip[1] = sx+(sx<srcLen-1);
+            wp[0] = 1-del;
+            wp[1] = del;
+        }
+        convertWeights(i);
+    }
+}
+
+// type of the horizontally resampled rows: fixed point for 8-bit,
+// float for the deeper types
+template<typename T> struct HType { typedef float type; };
+template<> struct HType<uchar> { typedef short type; };
+
+// NT is the tap count when known at compile time, 0 reads it from the table
+template<int NT, int cn>
+static void hresize(const uchar *src, short *dst, const AxisTable &tab, int c0, int c1) {
+    // one source row to output columns [c0,c1), RESAMPLE_HBITS fraction bits
+    const int ntaps = NT ? NT : tab.ntaps;
+    const int shift = RESAMPLE_WBITS-RESAMPLE_HBITS;
+    const int delta = 1 << (shift-1);
+
+    for(int j = c0; j < c1; j++) {
+        const int *ci = &tab.idx[j*ntaps];
+        const short *w = &tab.wfix[j*ntaps];
+        for(int k = 0; k < cn; k++) {
+            int sum = delta;
+            for(int t = 0; t < ntaps; t++)
+                sum += src[ci[t]*cn+k]*w[t];
+            *dst++ = (short)(sum >> shift);
+        }
+    }
+}
+
+template<int NT, int cn, typename T>
+static void hresize(const T *src, float *dst, const AxisTable &tab, int c0, int c1) {
+    const int ntaps = NT ? NT : tab.ntaps;
+    for(int j = c0; j < c1; j++) {
+        const int *ci = &tab.idx[j*ntaps];
+        const float *w = &tab.wf[j*ntaps];
+        for(int k = 0; k < cn; k++) {
+            float sum = 0;
+            for(int t = 0; t < ntaps; t++)
+                sum += src[ci[t]*cn+k]*w[t];
+            *dst++ = sum;
+        }
+    }
+}
+
+static inline void vresizeRow(VResizeFunc vresize, const short **rows, const AxisTable &tab,
+    int i, uchar *dst, int width) {
+    vresize(rows, &tab.wfix[i*tab.ntaps], tab.ntaps, dst, width);
+}
+
+template<typename T>
+static void vresizeRow(VResizeFunc, const float **rows, const AxisTable &tab,
+    int i, T *dst, int width) {
+    const float *w = &tab.wf[i*tab.ntaps];
+
+    if(tab.ntaps == 2) {
+        const float *r0 = rows[0], *r1 = rows[1];
+        for(int x = 0; x < width; x++)
+            dst[x] = saturate_cast<T>(r0[x]*w[0]+r1[x]*w[1]);
+    }
+    else if(tab.ntaps == 4) {
+        const float *r0 = rows[0], *r1 = rows[1], *r2 = rows[2], *r3 = rows[3];
+        for(int x = 0; x < width; x++)
+            dst[x] = saturate_cast<T>(r0[x]*w[0]+r1[x]*w[1]+r2[x]*w[2]+r3[x]*w[3]);
+    }
+    else {
+        for(int x = 0; x < width; x++) {
+            float sum = 0;
+            for(int t = 0; t < tab.ntaps; t++)
+                sum += rows[t][x]*w[t];
+            dst[x] = saturate_cast<T>(sum);
+        }
+    }
+}
+
+Resampler::Resampler() : s_(0), method_(RESAMPLE_BILINEAR), ceilSize_(false), \
+    kernel_(getResampleKernel()) {
+}
+
+void Resampler::setKernel(int kernel) {
+    if(kernel == RESAMPLE_KERNEL_AUTO || !resampleKernelSupported(kernel))
+        kernel = bestKernel();
+    kernel_ = kernel;
+}
+
+void Resampler::init(Size srcSize, double s, int method, bool ceilSize) {
+    // s <= 0 would make a negative output size
+    assert(s > 0);
+    if(srcSize == srcSize_ && s == s_ && method == method_ && ceilSize == ceilSize_ && s_ > 0)
+        return;
+
+    srcSize_ = srcSize;
+    s_ = s;
+    method_ = method;
+    ceilSize_ = ceilSize;
+    if(ceilSize)
+        dstSize_ = Size(cvCeil(srcSize.width*s), cvCeil(srcSize.height*s));
+    else
+        dstSize_ = Size(cvFloor(srcSize.width*s), cvFloor(srcSize.height*s));
+
+    rowTab_.build(srcSize.height, dstSize_.height, s, method);
+    colTab_.build(srcSize.width, dstSize_.width, s, method);
+}
+
+Resampler::TileFunc Resampler::tileFunc(int type) {
+    switch(type) {
+    case CV_8UC1:  return &Resampler::runTile<uchar, 1>;
+    case CV_8UC3:  return &Resampler::runTile<uchar, 3>;
+    case CV_8UC4:  return &Resampler::runTile<uchar, 4>;
+    case CV_16UC1: return &Resampler::runTile<ushort, 1>;
+    case CV_16UC3: return &Resampler::runTile<ushort, 3>;
+    case CV_16UC4: return &Resampler::runTile<ushort, 4>;
+    case CV_16SC1: return &Resampler::runTile<short, 1>;
+    case CV_16SC3: return &Resampler::runTile<short, 3>;
+    case CV_16SC4: return &Resampler::runTile<short, 4>;
+    case CV_32FC1: return &Resampler::runTile<float, 1>;
+    case CV_32FC3: return &Resampler::runTile<float, 3>;
+    case CV_32FC4: return &Resampler::runTile<float, 4>;
+    default:       return 0;
+    }
+}
+
+bool Resampler::supportsType(int type) {
+    return tileFunc(type) != 0;
+}
+
+void Resampler::run(const Mat &srcMat, Mat &dstMat) {
+    CV_Assert(srcMat.size() == srcSize_ && supportsType(srcMat.type()));
+    dstMat.create(dstSize_.height, dstSize_.width, srcMat.type());
+    if(dstSize_.width == 0 || dstSize_.height == 0)
+        return;
+
+    runRows(srcMat, 0, dstMat, 0, 0, dstSize_.height);
+}
+
+bool Resampler::runStream(RowSource &src, PnmWriter &dst, size_t stripBytes) {
+    int type = CV_MAKETYPE(src.depth, src.channels);
+    CV_Assert(Size(src.cols, src.rows) == srcSize_ && supportsType(type));
+    if(dstSize_.width == 0 || dstSize_.height == 0)
+        return true;
+
+    int cn = src.channels;
+    int ntaps = rowTab_.ntaps;
+    // strips are capped in rows too, so a downscale window stays small
+    int stripRows = max(1, (int)(stripBytes/((size_t)dstSize_.width*cn)));
+    stripRows = min(stripRows, 64);
+    Mat strip(min(stripRows, dstSize_.height), dstSize_.width, type);
+
+    // source rows [lo, nread) sit at the top of win; rows are read in
+    // order and dropped once the strips have moved past them
+    Mat win, skip(1, srcSize_.width, type);
+    size_t rowBytes = srcSize_.width*skip.elemSize();
+    int lo = 0, nread = 0;
+
+    for(int i0 = 0; i0 < dstSize_.height; i0 += stripRows) {
+        int i1 = min(i0+stripRows, dstSize_.height);
+        int first = rowTab_.idx[i0*ntaps];
+        int last = rowTab_.idx[(i1-1)*ntaps+ntaps-1];
+
+        // move the rows still needed to the top, growing the window if short
+        int keep = max(0, nread-first);
+        Mat next = win;
+        if(win.rows < last-first+1)
+            next = Mat(last-first+1, srcSize_.width, type);
+        for(int r = 0; r < keep; r++)
+            memmove(next.ptr<uchar>(r), win.ptr<uchar>(first-lo+r), rowBytes);
+        win = next;
+        lo = first;
+
+        // read on up to the last row, rows no strip uses are skipped
+        for(; nread <= last; nread++) {
+            uchar *row = nread < lo ? skip.ptr<uchar>(0) : win.ptr<uchar>(nread-lo);
+            if(!src.readRow(row))
+                return false;
+        }
+
+        runRows(win, lo, strip, i0, i0, i1);
+        if(!dst.writeRows(strip, i1-i0))
+            return false;
+    }
+    return true;
+}
+
+void Resampler::runRows(const Mat &srcMat, int srcRow0, Mat &dstMat, int dstRow0,
+    int r0, int r1) {
+    int cn = srcMat.channels();
+    int ntaps = rowTab_.ntaps;
+    int nthreads = getResampleThreads();
+    int nrows = r1-r0;
+    int hsize = srcMat.depth() == CV_8U ? sizeof(short) : sizeof(float);
+    TileFunc tile = tileFunc(srcMat.type());
+
+    // column strips sized to the cache, row bands to feed every worker
+    int tw = max(1, min(dstSize_.width, RESAMPLE_TILE_BYTES/(ntaps*cn*hsize)));
+    int ncols = (dstSize_.width+tw-1)/tw;
+    int nbands = nthreads == 1 ? 1 : min(nrows, max(1, 4*nthreads/ncols));
+    int bh = (nrows+nbands-1)/nbands;
+    nbands = (nrows+bh-1)/bh;
+
+    hbufs_.resize(nthreads);
+    for(int w = 0; w < nthreads; w++)
+        hbufs_[w].resize(ntaps*tw*cn*hsize);
+
+    pool->parallelFor(nbands*ncols, [&](int t, int worker) {
+        int t0 = r0+(t/ncols)*bh;
+        int c0 = (t%ncols)*tw;
+        (this->*tile)(srcMat, srcRow0, dstMat, dstRow0, t0, min(t0+bh, r1), \
+            c0, min(c0+tw, dstSize_.width), &hbufs_[worker][0]);
+    });
+}
+
+template<typename T, int cn>
+void Resampler::runTile(const Mat &srcMat, int srcRow0, Mat &dstMat, int dstRow0,
+    int r0, int r1, int c0, int c1, uchar *hbuf) {
+    typedef typename HType<T>::type HT;
+    int dw = (c1-c0)*cn;
+    int ntaps = rowTab_.ntaps;
+    int hnt = colTab_.ntaps;
+    VResizeFunc vresize = vresizeFunc(kernel_);
+
+    // one cache slot per tap, each holds a horizontally resampled source row;
+    // the fixed arrays cover bilinear and bicubic, area may need more
+    HT *slotBuf[4];
+    int rowBuf[4];
+    const HT *rowsBuf[4];
+    vector<HT*> slotVec;
+    vector<int> rowVec;
+    vector<const HT*> rowsVec;
+    HT **slot = slotBuf;
+    int *slotRow = rowBuf;
+    const HT **rows = rowsBuf;
+    if(ntaps > 4) {
+        slotVec.resize(ntaps);
+        rowVec.resize(ntaps);
+        rowsVec.resize(ntaps);
+        slot = &slotVec[0];
+        slotRow = &rowVec[0];
+        rows = &rowsVec[0];
+    }
+    for(int t = 0; t < ntaps; t++) {
+        slot[t] = (HT*)hbuf+t*dw;
+        slotRow[t] = -1;
+    }
+
+    for(int i = r0; i < r1; i++) {
+        const int *ri = &rowTab_.idx[i*ntaps];
+
+        for(int t = 0; t < ntaps; t++) {
+            // the taps of a row lie within ntaps consecutive source rows,
+            // so slot (row % ntaps) is never needed twice by one output row
+            int s = ri[t]%ntaps;
+            if(slotRow[s] != ri[t]) {
+                const T *src = srcMat.ptr<T>(ri[t]-srcRow0);
+                if(hnt == 2)
+                    hresize<2, cn>(src, slot[s], colTab_, c0, c1);
+                else if(hnt == 4)
+                    hresize<4, cn>(src, slot[s], colTab_, c0, c1);
+                else
+                    hresize<0, cn>(src, slot[s], colTab_, c0, c1);
+                slotRow[s] = ri[t];
+            }
+            rows[t] = slot[s];
+        }
+
+        vresizeRow(vresize, rows, rowTab_, i, dstMat.ptr<T>(i-dstRow0)+c0*cn, dw);
+    }
+}
+
+int myresize_l(Mat &srcMat, Mat &dstMat, double s) {
+    Resampler rs;
+    rs.init(srcMat.size(), s, RESAMPLE_BILINEAR);
+    rs.run(srcMat, dstMat);
+    return 1;
+}
+
+int myresize_c(Mat &srcMat, Mat &dstMat, double s) {
+    Resampler rs;
+    rs.init(srcMat.size(), s, RESAMPLE_BICUBIC);
+    rs.run(srcMat, dstMat);
+    return 1;
+}
+
+int myresize_a(Mat &srcMat, Mat &dstMat, double s) {
+    Resampler rs;
+    rs.init(srcMat.size(), s, RESAMPLE_AREA);
+    rs.run(srcMat, dstMat);
+    return 1;
+}
@@ -0,0 +1,126 @@
+#ifndef RESAMPLE_H
+#define RESAMPLE_H
+
+#include <vector>
+#include <opencv2/opencv.hpp>
+
+class RowSource;
+class PnmWriter;
+
+// interpolation methods, same values as <option> on the command line
+enum ResampleMethod {
+    RESAMPLE_BILINEAR = 0,
+    RESAMPLE_BICUBIC = 1,
+    RESAMPLE_AREA = 2     // box filter over the exact pixel coverage
+};
+
+// vertical pass implementations, selected with --kernel
+enum ResampleKernel {
+    RESAMPLE_KERNEL_AUTO = -1,
+    RESAMPLE_KERNEL_SCALAR = 0,
+    RESAMPLE_KERNEL_SSE = 1,
+    RESAMPLE_KERNEL_AVX2 = 2
+};
+
+bool resampleKernelSupported(int kernel);
+const char* resampleKernelName(int kernel);
+// kernel for a --kernel= name (a resampleKernelName() or "auto"),
+// -2 when there is no such kernel
+int parseResampleKernel(const char *name);
+// set the kernel used by Resamplers created afterwards,
+// returns the kernel actually in effect (AUTO picks the best supported)
+int setResampleKernel(int kernel);
+int getResampleKernel();
+
+// number of worker threads for all Resamplers, 0 uses every core;
+// output does not depend on it
+void setResampleThreads(int nthreads);
+int getResampleThreads();
+
+// Source taps and weights along one axis.
+// For dst coordinate i the taps are idx[i*ntaps .. i*ntaps+ntaps-1]
+// (already clamped to the source) with weights w[] at the same positions,
+// wfix[] holds the same weights in fixed point for 8-bit images and
+// wf[] as floats for the deeper types.
+// Area tables have as many taps as the widest footprint (rounded up to
+// even), shorter footprints are padded with zero weights.
+struct AxisTable {
+    int ntaps;
+    std::vector<int> idx;
+    std::vector<double> w;
+    std::vector<short> wfix;
+    std::vector<float> wf;
+
+    void build(int srcLen, int dstLen, double s, int method);
+
+private:
+    void buildArea(int srcLen, int dstLen, double s);
+    void convertWeights(int i);
+};
+
+// Resampling engine for 8U, 16U, 16S and 32F images of 1, 3 or 4 channels.
+// init() builds the row/column tables once per (src size, scale, method),
+// run() can then be called on any number of images of that size.
+// Each output row is a vertical combination of horizontally resampled
+// source rows; those are cached, so every source row is filtered once
+// per tile. The output is split into tiles of column strips (sized so the
+// cached rows stay in L2) times row bands, run on the shared pool.
+// runStream() does the same strip by strip from a row source, holding
+// only the source rows the current strip needs.
+class Resampler {
+public:
+    Resampler();
+
+    // the output is floor(src*s), or with ceilSize ceil(src*s), whose last
+    // pixel then covers only the rest of the source (area: a partial tap)
+    void init(cv::Size srcSize, double s, int method, bool ceilSize = false);
+    void run(const cv::Mat &srcMat, cv::Mat &dstMat);
+    // source rows are read as needed, output goes out in strips of
+    // about stripBytes; returns false on a read or write error
+    bool runStream(RowSource &src, PnmWriter &dst, size_t stripBytes = 4 << 20);
+
+    static bool supportsType(int type);
+
+    void setKernel(int kernel);
+    int kernel() const { return kernel_; }
+
+    cv::Size srcSize() const { return srcSize_; }
+    cv::Size dstSize() const { return dstSize_; }
+    double scale() const { return s_; }
+    int method() const { return method_; }
+
+private:
+    typedef void (Resampler::*TileFunc)(const cv::Mat &srcMat, int srcRow0,
+        cv::Mat &dstMat, int dstRow0, int r0, int r1, int c0, int c1, uchar *hbuf);
+    // runTile instantiated for the depth and channel count of type
+    static TileFunc tileFunc(int type);
+
+    // output rows [r0,r1); srcMat row 0 is source row srcRow0 and
+    // dstMat row 0 is output row dstRow0
+    void runRows(const cv::Mat &srcMat, int srcRow0, cv::Mat &dstMat, int dstRow0,
+        int r0, int r1);
+    template<typename T, int cn>
+    void runTile(const cv::Mat &srcMat, int srcRow0, cv::Mat &dstMat, int dstRow0,
+        int r0, int r1, int c0, int c1, uchar *hbuf);
+
+    cv::Size srcSize_;
+    cv::Size dstSize_;
+    double s_;
+    int method_;
+    bool ceilSize_;
+    int kernel_;
+
+    AxisTable rowTab_;  // taps along rows (x in the original notation)
+    AxisTable colTab_;  // taps along cols (y in the original notation)
+
+    // per worker: horizontally resampled source rows of the current tile,
+    // shorts for 8-bit and floats otherwise
+    std::vector<std::vector<uchar> > hbufs_;
+};
+
+int myresize_l(cv::Mat &srcMat, cv::Mat &dstMat, double s);
+int myresize_c(cv::Mat &srcMat, cv::Mat &dstMat, double s);
+// area average when shrinking, bilinear when enlarging
+int myresize_a(cv::Mat &srcMat, cv::Mat &dstMat, double s);
+
+#endif
@@ -0,0 +1,57 @@
+// built with -mavx2, only called after a runtime cpu check
+#include <immintrin.h>
+#include "resample_kernels.h"
+
+static inline __m256i pairWeight(short a, short b) {
+    return _mm256_set1_epi32((int)((unsigned short)a | ((unsigned)(unsigned short)b << 16)));
+}
+
+// sum of taps (a,b) weighted by wab for 16 shorts, as 2x8 ints
+static inline void maddPair(__m256i a, __m256i b, __m256i wab, __m256i &lo, __m256i &hi) {
+    lo = _mm256_add_epi32(lo, _mm256_madd_epi16(_mm256_unpacklo_epi16(a, b), wab));
+    hi = _mm256_add_epi32(hi, _mm256_madd_epi16(_mm256_unpackhi_epi16(a, b), wab));
+}
+
+static inline __m256i load16(const short *p) {
+    return _mm256_loadu_si256((const __m256i*)p);
+}
+
+template<int NT>
+static void vresizeN(const short **rows, const short *w, int ntaps,
+    unsigned char *dst, int width) {
+    // NT fixes the tap count at compile time, 0 takes it from ntaps
+    const int n = NT ? NT : ntaps;
+    const __m256i delta = _mm256_set1_epi32(1 << (RESAMPLE_VSHIFT-1));
+
+    // 32 interleaved bytes per iteration
+    int x = 0;
+    for(; x <= width-32; x += 32) {
+        __m256i s[2];
+        for(int h = 0; h < 2; h++) {
+            int o = x+h*16;
+            __m256i lo = delta, hi = delta;
+            for(int t = 0; t < n; t += 2)
+                maddPair(load16(rows[t]+o), load16(rows[t+1]+o), pairWeight(w[t], w[t+1]), lo, hi);
+            lo = _mm256_srai_epi32(lo, RESAMPLE_VSHIFT);
+            hi = _mm256_srai_epi32(hi, RESAMPLE_VSHIFT);
+            // unpack and pack are both per 128-bit lane, so this is in order
+            s[h] = _mm256_packs_epi32(lo, hi);
+        }
+        // saturating pack clamps to [0,255]; fix the lane interleave after it
+        __m256i d = _mm256_packus_epi16(s[0], s[1]);
+        d = _mm256_permute4x64_epi64(d, 0xD8);
+        _mm256_storeu_si256((__m256i*)(dst+x), d);
+    }
+
+    vresize_scalar_tail(rows, w, n, dst, x, width);
+}
+
+void vresize_avx2(const short **rows, const short *w, int ntaps,
+    unsigned char *dst, int width) {
+    if(ntaps == 2)
+        vresizeN<2>(rows, w, ntaps, dst, width);
+    else if(ntaps == 4)
+        vresizeN<4>(rows, w, ntaps, dst, width);
+    else
+        vresizeN<0>(rows, w, ntaps, dst, width);
+}
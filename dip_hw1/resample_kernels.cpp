@@ -0,0 +1,35 @@
+#include "resample_kernels.h"
+
+static inline unsigned char clamp255(int v) {
+    return (unsigned char)(v < 0 ? 0 : (v > 255 ? 255 : v));
+}
+
+template<int NT>
+static void vresizeN(const short **rows, const short *w, int ntaps,
+    unsigned char *dst, int x0, int width) {
+    // NT fixes the tap count at compile time, 0 takes it from ntaps
+    const int n = NT ? NT : ntaps;
+    const int delta = 1 << (RESAMPLE_VSHIFT-1);
+
+    for(int x = x0; x < width; x++) {
+        int sum = delta;
+        for(int t = 0; t < n; t++)
+            sum += rows[t][x]*w[t];
+        dst[x] = clamp255(sum >> RESAMPLE_VSHIFT);
+    }
+}
+
+void vresize_scalar_tail(const short **rows, const short *w, int ntaps,
+    unsigned char *dst, int x0, int width) {
+    if(ntaps == 2)
+        vresizeN<2>(rows, w, ntaps, dst, x0, width);
+    else if(ntaps == 4)
+        vresizeN<4>(rows, w, ntaps, dst, x0, width);
+    else
+        vresizeN<0>(rows, w, ntaps, dst, x0, width);
+}
+
+void vresize_scalar(const short **rows, const short *w, int ntaps,
+    unsigned char *dst, int width) {
+    vresize_scalar_tail(rows, w, ntaps, dst, 0, width);
+}
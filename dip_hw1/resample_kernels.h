@@ -0,0 +1,32 @@
+#ifndef RESAMPLE_KERNELS_H
+#define RESAMPLE_KERNELS_H
+
+// Fixed-point layout shared by all kernels:
+// weights are shorts with 1.0 == 1<<RESAMPLE_WBITS, the horizontal pass
+// keeps RESAMPLE_HBITS fractional bits in its short output, and the
+// vertical pass shifts the products back by RESAMPLE_VSHIFT.
+#define RESAMPLE_WBITS 14
+#define RESAMPLE_HBITS 6
+#define RESAMPLE_VSHIFT (RESAMPLE_WBITS+RESAMPLE_HBITS)
+
+// vertical pass: dst[x] = clamp((sum_t rows[t][x]*w[t] + round) >> VSHIFT)
+// clamped to [0,255]; ntaps is even, 2 (bilinear), 4 (bicubic) or more
+// (area), the SIMD kernels take the taps in pairs
+typedef void (*VResizeFunc)(const short **rows, const short *w, int ntaps,
+    unsigned char *dst, int width);
+
+void vresize_scalar(const short **rows, const short *w, int ntaps,
+    unsigned char *dst, int width);
+// scalar pass over columns [x0, width), finishes the SIMD kernels' rows
+void vresize_scalar_tail(const short **rows, const short *w, int ntaps,
+    unsigned char *dst, int x0, int width);
+#ifdef RESAMPLE_HAVE_SSE41
+void vresize_sse41(const short **rows, const short *w, int ntaps,
+    unsigned char *dst, int width);
+#endif
+#ifdef RESAMPLE_HAVE_AVX2
+void vresize_avx2(const short **rows, const short *w, int ntaps,
+    unsigned char *dst, int width);
+#endif
+
+#endif
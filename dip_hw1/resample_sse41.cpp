@@ -0,0 +1,54 @@
+// built with -msse4.1, only called after a runtime cpu check
+#include <smmintrin.h>
+#include "resample_kernels.h"
+
+static inline __m128i pairWeight(short a, short b) {
+    return _mm_set1_epi32((int)((unsigned short)a | ((unsigned)(unsigned short)b << 16)));
+}
+
+// sum of taps (a,b) weighted by wab for 8 shorts, as 2x4 ints
+static inline void maddPair(__m128i a, __m128i b, __m128i wab, __m128i &lo, __m128i &hi) {
+    lo = _mm_add_epi32(lo, _mm_madd_epi16(_mm_unpacklo_epi16(a, b), wab));
+    hi = _mm_add_epi32(hi, _mm_madd_epi16(_mm_unpackhi_epi16(a, b), wab));
+}
+
+static inline __m128i load8(const short *p) {
+    return _mm_loadu_si128((const __m128i*)p);
+}
+
+template<int NT>
+static void vresizeN(const short **rows, const short *w, int ntaps,
+    unsigned char *dst, int width) {
+    // NT fixes the tap count at compile time, 0 takes it from ntaps
+    const int n = NT ? NT : ntaps;
+    const __m128i delta = _mm_set1_epi32(1 << (RESAMPLE_VSHIFT-1));
+
+    // 16 interleaved bytes per iteration
+    int x = 0;
+    for(; x <= width-16; x += 16) {
+        __m128i s[2];
+        for(int h = 0; h < 2; h++) {
+            int o = x+h*8;
+            __m128i lo = delta, hi = delta;
+            for(int t = 0; t < n; t += 2)
+                maddPair(load8(rows[t]+o), load8(rows[t+1]+o), pairWeight(w[t], w[t+1]), lo, hi);
+            lo = _mm_srai_epi32(lo, RESAMPLE_VSHIFT);
+            hi = _mm_srai_epi32(hi, RESAMPLE_VSHIFT);
+            s[h] = _mm_packs_epi32(lo, hi);
+        }
+        // saturating pack clamps to [0,255]
+        _mm_storeu_si128((__m128i*)(dst+x), _mm_packus_epi16(s[0], s[1]));
+    }
+
+    vresize_scalar_tail(rows, w, n, dst, x, width);
+}
+
+void vresize_sse41(const short **rows, const short *w, int ntaps,
+    unsigned char *dst, int width) {
+    if(ntaps == 2)
+        vresizeN<2>(rows, w, ntaps, dst, width);
+    else if(ntaps == 4)
+        vresizeN<4>(rows, w, ntaps, dst, width);
+    else
+        vresizeN<0>(rows, w, ntaps, dst, width);
+}
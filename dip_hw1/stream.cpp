@@ -0,0 +1,166 @@
+#include <cctype>
+#include <algorithm>
+#include "stream.h"
+
+using namespace std;
+using namespace cv;
+
+static void swapBytes16(uchar *p, size_t n) {
+    // netpbm stores 16-bit samples big-endian
+    for(size_t i = 0; i < n; i++)
+        swap(p[2*i], p[2*i+1]);
+}
+
+static bool bigEndianHost() {
+    unsigned short one = 1;
+    return *(uchar*)&one == 0;
+}
+
+static bool readHeaderInt(FILE *fp, int &v) {
+    // skip whitespace and comments, then read a decimal number
+    int c = getc(fp);
+    while(c != EOF && (isspace(c) || c == '#')) {
+        if(c == '#')
+            while(c != EOF && c != '\n')
+                c = getc(fp);
+        c = getc(fp);
+    }
+    if(c == EOF || !isdigit(c))
+        return false;
+
+    v = 0;
+    while(c != EOF && isdigit(c)) {
+        v = v*10+(c-'0');
+        c = getc(fp);
+    }
+    // exactly one whitespace ends the header field
+    return c != EOF && isspace(c);
+}
+
+PnmReader::~PnmReader() {
+    if(fp_)
+        fclose(fp_);
+}
+
+bool PnmReader::open(const string &path) {
+    fp_ = fopen(path.c_str(), "rb");
+    if(!fp_)
+        return false;
+
+    char magic[2];
+    if(fread(magic, 1, 2, fp_) != 2 || magic[0] != 'P' || (magic[1] != '5' && magic[1] != '6'))
+        return false;
+    channels = (magic[1] == '6') ? 3 : 1;
+
+    if(!readHeaderInt(fp_, cols) || !readHeaderInt(fp_, rows) || !readHeaderInt(fp_, maxval_))
+        return false;
+    depth = maxval_ > 255 ? CV_16U : CV_8U;
+    return cols > 0 && rows > 0 && maxval_ > 0 && maxval_ <= 65535;
+}
+
+// v*top/maxval rounded, samples above maxval clip to top
+template<typename T>
+static void rescale(T *p, size_t n, unsigned maxval, unsigned top) {
+    for(size_t i = 0; i < n; i++) {
+        unsigned v = min((unsigned)p[i], maxval);
+        p[i] = (T)((v*top+maxval/2)/maxval);
+    }
+}
+
+bool PnmReader::readRow(uchar *row) {
+    size_t n = (size_t)cols*channels;
+    if(depth == CV_8U) {
+        if(fread(row, 1, n, fp_) != n)
+            return false;
+        if(maxval_ != 255)
+            rescale(row, n, maxval_, 255);
+        return true;
+    }
+
+    if(fread(row, 2, n, fp_) != n)
+        return false;
+    if(!bigEndianHost())
+        swapBytes16(row, n);
+    // v*65535 fits in 32 bits for v <= 65535
+    if(maxval_ != 65535)
+        rescale((ushort*)row, n, maxval_, 65535);
+    return true;
+}
+
+MatRowSource::MatRowSource(const Mat &img) : next_(0) {
+    if(img.channels() == 3)
+        cvtColor(img, img_, CV_BGR2RGB);
+    else
+        img_ = img;
+    rows = img_.rows;
+    cols = img_.cols;
+    channels = img_.channels();
+    depth = img_.depth();
+}
+
+bool MatRowSource::readRow(uchar *row) {
+    if(next_ >= rows)
+        return false;
+    const uchar *p = img_.ptr<uchar>(next_++);
+    copy(p, p+cols*img_.elemSize(), row);
+    return true;
+}
+
+PnmWriter::~PnmWriter() {
+    close();
+}
+
+bool PnmWriter::open(const string &path, int rows, int cols, int channels, int depth) {
+    fp_ = fopen(path.c_str(), "wb");
+    if(!fp_)
+        return false;
+    depth_ = depth;
+    return fprintf(fp_, "P%c\n%d %d\n%d\n", channels == 3 ? '6' : '5', cols, rows, \
+        depth == CV_16U ? 65535 : 255) > 0;
+}
+
+bool PnmWriter::writeRows(const Mat &strip, int n) {
+    size_t w = (size_t)strip.cols*strip.channels();
+    bool swapped = depth_ == CV_16U && !bigEndianHost();
+    size_t bytes = w*strip.elemSize1();
+    if(swapped)
+        buf_.resize(bytes);
+
+    for(int i = 0; i < n; i++) {
+        const uchar *p = strip.ptr<uchar>(i);
+        if(swapped) {
+            copy(p, p+bytes, buf_.begin());
+            swapBytes16(&buf_[0], w);
+            p = &buf_[0];
+        }
+        if(fwrite(p, 1, bytes, fp_) != bytes)
+            return false;
+    }
+    return true;
+}
+
+bool PnmWriter::close() {
+    bool ok = true;
+    if(fp_) {
+        ok = fclose(fp_) == 0;
+        fp_ = 0;
+    }
+    return ok;
+}
+
+bool isPnmPath(const string &path) {
+    string ext = path.substr(path.find_last_of(".")+1);
+    for(size_t i = 0; i < ext.size(); i++)
+        ext[i] = tolower(ext[i]);
+    return ext == "ppm" || ext == "pgm" || ext == "pnm";
+}
+
+string outputExt(const Mat &img) {
+    // JPEG as before where it can hold the result, PNG for alpha and
+    // 16-bit, OpenEXR for float
+    if(img.depth() == CV_32F)
+        return ".exr";
+    if(img.depth() != CV_8U || img.channels() == 4)
+        return ".png";
+    return ".jpg";
+}
@@ -0,0 +1,76 @@
+#ifndef STREAM_H
+#define STREAM_H
+
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <opencv2/opencv.hpp>
+
+// Row-at-a-time image input for the streaming resize.
+class RowSource {
+public:
+    RowSource() : rows(0), cols(0), channels(0), depth(CV_8U) {}
+    virtual ~RowSource() {}
+
+    // next row, cols*channels samples of depth
+    virtual bool readRow(uchar *row) = 0;
+
+    int rows;
+    int cols;
+    int channels;
+    int depth;
+};
+
+// Binary netpbm (P5 gray / P6 RGB) read row by row, only one row is ever
+// held. maxval up to 255 gives 8U rows, up to 65535 gives 16U rows; other
+// maxvals than 255 and 65535, like 1023 or 4095 of 10 and 12-bit scans,
+// are scaled to the full range, as PnmWriter always writes 255 or 65535.
+class PnmReader : public RowSource {
+public:
+    PnmReader() : fp_(0), maxval_(255) {}
+    ~PnmReader();
+
+    bool open(const std::string &path);
+    bool readRow(uchar *row);
+
+private:
+    FILE *fp_;
+    int maxval_;
+};
+
+// Rows of an image that is already decoded, for formats we cannot read
+// incrementally. Color images are handed out as RGB to match PPM.
+class MatRowSource : public RowSource {
+public:
+    explicit MatRowSource(const cv::Mat &img);
+
+    bool readRow(uchar *row);
+
+private:
+    cv::Mat img_;
+    int next_;
+};
+
+// Binary netpbm output written in strips, P6 for color and P5 for gray,
+// 8U or 16U samples.
+class PnmWriter {
+public:
+    PnmWriter() : fp_(0), depth_(CV_8U) {}
+    ~PnmWriter();
+
+    bool open(const std::string &path, int rows, int cols, int channels, int depth = CV_8U);
+    // append the first n rows of strip
+    bool writeRows(const cv::Mat &strip, int n);
+    bool close();
+
+private:
+    FILE *fp_;
+    int depth_;
+    std::vector<uchar> buf_;
+};
+
+bool isPnmPath(const std::string &path);
+// extension for writing img with imwrite: .jpg, .png or .exr
+std::string outputExt(const cv::Mat &img);
+
+#endif
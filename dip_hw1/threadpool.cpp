@@ -0,0 +1,100 @@
+#include "threadpool.h"
+
+using namespace std;
+
+ThreadPool::ThreadPool(int nthreads) :
+    nthreads_(nthreads < 1 ? 1 : nthreads), generation_(0), remaining_(0), stop_(false) {
+    for(int i = 0; i < nthreads_; i++)
+        queues_.push_back(new Queue);
+
+    // a single worker runs inline in the caller
+    if(nthreads_ > 1)
+        for(int i = 0; i < nthreads_; i++)
+            threads_.push_back(thread(&ThreadPool::worker, this, i));
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        lock_guard<mutex> lock(m_);
+        stop_ = true;
+    }
+    start_.notify_all();
+    for(size_t i = 0; i < threads_.size(); i++)
+        threads_[i].join();
+    for(size_t i = 0; i < queues_.size(); i++)
+        delete queues_[i];
+}
+
+void ThreadPool::parallelFor(int ntasks, const function<void(int, int)> &fn) {
+    if(ntasks <= 0)
+        return;
+    if(nthreads_ == 1) {
+        for(int t = 0; t < ntasks; t++)
+            fn(t, 0);
+        return;
+    }
+
+    unique_lock<mutex> lock(m_);
+    remaining_ = ntasks;
+    for(int t = 0; t < ntasks; t++) {
+        Queue *q = queues_[t % nthreads_];
+        Task task = { t, &fn };
+        lock_guard<mutex> qlock(q->m);
+        q->tasks.push_back(task);
+    }
+
+    generation_++;
+    start_.notify_all();
+    done_.wait(lock, [this] { return remaining_ == 0; });
+}
+
+bool ThreadPool::popTask(int id, Task &task) {
+    // own queue first, from the front
+    {
+        Queue *q = queues_[id];
+        lock_guard<mutex> lock(q->m);
+        if(!q->tasks.empty()) {
+            task = q->tasks.front();
+            q->tasks.pop_front();
+            return true;
+        }
+    }
+    // then steal from the back of the others
+    for(int i = 1; i < nthreads_; i++) {
+        Queue *q = queues_[(id+i) % nthreads_];
+        lock_guard<mutex> lock(q->m);
+        if(!q->tasks.empty()) {
+            task = q->tasks.back();
+            q->tasks.pop_back();
+            return true;
+        }
+    }
+    return false;
+}
+
+void ThreadPool::worker(int id) {
+    unsigned seen = 0;
+    for(;;) {
+        {
+            unique_lock<mutex> lock(m_);
+            start_.wait(lock, [&] { return stop_ || generation_ != seen; });
+            if(stop_)
+                return;
+            seen = generation_;
+        }
+
+        Task task;
+        int finished = 0;
+        while(popTask(id, task)) {
+            (*task.fn)(task.idx, id);
+            finished++;
+        }
+
+        if(finished) {
+            lock_guard<mutex> lock(m_);
+            remaining_ -= finished;
+            if(remaining_ == 0)
+                done_.notify_all();
+        }
+    }
+}
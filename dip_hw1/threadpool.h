@@ -0,0 +1,56 @@
+#ifndef THREADPOOL_H
+#define THREADPOOL_H
+
+#include <deque>
+#include <vector>
+#include <mutex>
+#include <thread>
+#include <functional>
+#include <condition_variable>
+
+// Fixed-size pool of workers with one task queue each.
+// parallelFor() deals the tasks round-robin to the queues; a worker takes
+// from the front of its own queue and steals from the back of the others
+// once it runs dry, so uneven tiles still keep every core busy.
+class ThreadPool {
+public:
+    explicit ThreadPool(int nthreads);
+    ~ThreadPool();
+
+    int size() const { return nthreads_; }
+
+    // run fn(task, worker) for task in [0, ntasks) and wait for all of them,
+    // worker in [0, size()) can index per-worker scratch buffers
+    void parallelFor(int ntasks, const std::function<void(int, int)> &fn);
+
+private:
+    typedef std::function<void(int, int)> Func;
+
+    // the function travels with the task, a worker still draining the
+    // previous round may pick up tasks of the next one
+    struct Task {
+        int idx;
+        const Func *fn;
+    };
+
+    struct Queue {
+        std::mutex m;
+        std::deque<Task> tasks;
+    };
+
+    void worker(int id);
+    bool popTask(int id, Task &task);
+
+    int nthreads_;
+    std::vector<std::thread> threads_;
+    std::vector<Queue*> queues_;
+
+    std::mutex m_;
+    std::condition_variable start_;
+    std::condition_variable done_;
+    unsigned generation_;
+    int remaining_;
+    bool stop_;
+};
+
+#endif
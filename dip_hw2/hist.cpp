@@ -1,6 +1,11 @@
 #include <cstdio>
+#include <cmath>
 #include <cassert>
+#include <cstring>
 #include <string>
+#include <vector>
+#include <fstream>
+#include <algorithm>
 
 #include <opencv2/opencv.hpp>
 #define cvQueryHistValue_1D( hist, idx0 ) \
@@ -10,151 +15,670 @@ cvGetReal1D( (hist)->bins, (idx0) )
 using namespace std;
 using namespace cv;
 
-// parameters for calcHist()
-int nBins = 256;
-float range[2] = {0,256};
-const float* histRange = {range};
+// histogram parameters
+const int nBins = 256;
+
+// pixels per chunk of the parallel histogram, each chunk counts into
+// private 32-bit bins that cannot overflow at this size
+#define HIST_CHUNK_PIXELS (1 << 22)
 
 int hist_w=nBins;
 int hist_h=256;
 
-void genHistImg(Mat &hist_o, Mat &histImg) {
-    Mat hist = hist_o.clone();    
+// Every stage is a point operation on the previous one, so each is kept
+// as one LUT composed all the way from the source: a stage image is a
+// single LUT pass over srcImg, and a stage histogram is the source
+// histogram pushed through that LUT without reading any pixel again.
+// CLAHE is the exception: one LUT per tile, blended per pixel.
+enum Stage { STAGE_SRC, STAGE_GAMMA, STAGE_DEGRAD, STAGE_STRETCH, STAGE_EQUAL, STAGE_CLAHE, NSTAGES };
+const char *stageNames[NSTAGES] = {"src", "gamma", "degrad", "stretch", "equal", "clahe"};
+
+static inline void countRow(const uchar *p, int n, unsigned h[4][nBins]) {
+    // four sub-histograms take every fourth pixel, so runs of equal pixels
+    // do not stall on incrementing the same counter
+    int x = 0;
+    for(; x<=n-4; x+=4) {
+        h[0][p[x]]++;
+        h[1][p[x+1]]++;
+        h[2][p[x+2]]++;
+        h[3][p[x+3]]++;
+    }
+    for(; x<n; x++)
+        h[0][p[x]]++;
+}
+
+// Counts one chunk of rows per task into its own bins, the sub-histograms
+// of countRow() are folded at the end of the chunk.
+class HistBody : public ParallelLoopBody {
+public:
+    HistBody(const Mat &img, int chunkRows, unsigned *bins) :
+        img_(img), chunkRows_(chunkRows), bins_(bins) {}
+
+    void operator()(const Range &r) const {
+        for(int c=r.start; c<r.end; c++) {
+            unsigned h[4][nBins];
+            memset(h, 0, sizeof(h));
+            int r1 = min(img_.rows, (c+1)*chunkRows_);
+            for(int y=c*chunkRows_; y<r1; y++)
+                countRow(img_.ptr<uchar>(y), img_.cols, h);
+            unsigned *bins = bins_+c*nBins;
+            for(int i=0; i<nBins; i++)
+                bins[i] = h[0][i]+h[1][i]+h[2][i]+h[3][i];
+        }
+    }
+
+private:
+    const Mat &img_;
+    int chunkRows_;
+    unsigned *bins_;
+};
+
+void calcHist64(const Mat &img, uint64 *hist) {
+    // exact counts of an 8-bit gray image, chunks run in parallel and are
+    // summed into 64-bit bins
+    int chunkRows = max(1, HIST_CHUNK_PIXELS/max(img.cols, 1));
+    int nchunks = (img.rows+chunkRows-1)/chunkRows;
+    vector<unsigned> bins(nchunks*nBins);
+    if(nchunks > 0)
+        parallel_for_(Range(0, nchunks), HistBody(img, chunkRows, &bins[0]));
+
+    for(int i=0; i<nBins; i++)
+        hist[i] = 0;
+    for(int c=0; c<nchunks; c++)
+        for(int i=0; i<nBins; i++)
+            hist[i] += bins[c*nBins+i];
+}
+
+void genHistImg(const uint64 *counts, Mat &histImg) {
+    Mat hist(nBins, 1, CV_32F);
+    for(int i=0; i<nBins; i++)
+        hist.at<float>(i) = (float)counts[i];
     normalize(hist, hist, 0, 1, NORM_MINMAX);
-    
+
     // plot histogram
     histImg.setTo(Scalar(0));
     for(int i=1; i<nBins; i++)
     {
         line(histImg, Point(i-1, hist_h-hist.at<float>(i-1)*hist_h), Point(i, hist_h-hist.at<float>(i)*hist_h), Scalar(255));
     }
-} 
+}
 
-int main(int argc, char** argv)
-{
-    assert(argc==2);    
-    
-    Mat srcImg;     // source image
-    Mat hist;       // histogram
-    Mat histImg(hist_h, hist_w, CV_8U, Scalar(0));    // visualize histogram
+void pushHist(const uint64 *srcHist, const uchar *lut, uint64 *hist) {
+    // histogram of lut(src): each source bin lands on bin lut[i] as a whole
+    for(int i=0; i<nBins; i++)
+        hist[i] = 0;
+    for(int i=0; i<nBins; i++)
+        hist[lut[i]] += srcHist[i];
+}
+
+void composeLut(const uchar *first, const uchar *then, uchar *lut) {
+    for(int i=0; i<256; i++)
+        lut[i] = then[first[i]];
+}
+
+void equalizeLut(const uint64 *hist, uchar *lut) {
+    // the CDF is the transformation function, rounded in integers so it
+    // stays exact for any image size
+    uint64 npixels = 0;
+    for(int i=0; i<nBins; i++)
+        npixels += hist[i];
+
+    uint64 sum = 0;
+    for(int i=0; i<nBins; i++) {
+        sum += hist[i];
+        lut[i] = (uchar)((510*sum+npixels)/(2*npixels));
+    }
+}
+
+void clipHist(uint64 *hist, uint64 limit) {
+    // cut the bins at limit and hand the excess back evenly, the remainder
+    // spread over the whole range
+    uint64 excess = 0;
+    for(int i=0; i<nBins; i++) {
+        if(hist[i] > limit) {
+            excess += hist[i]-limit;
+            hist[i] = limit;
+        }
+    }
+    uint64 each = excess/nBins;
+    int rest = excess%nBins;
+    for(int i=0; i<nBins; i++)
+        hist[i] += each;
+    for(int i=0, step=max(nBins/max(rest, 1), 1); i<nBins && rest>0; i+=step, rest--)
+        hist[i]++;
+}
+
+// CLAHE of the image srcLut maps the source to, on a tilesX x tilesY grid.
+// Each tile gets its own equalization LUT from its clipped histogram; a
+// pixel blends the LUTs of the four tiles around it bilinearly. Every pixel
+// is counted in exactly one tile, so the cost per pixel does not depend on
+// the tile size.
+struct Clahe {
+    int tilesX, tilesY;
+    double clip;        // bin limit in multiples of the mean bin count
+    int tileW, tileH;
+    vector<uchar> luts; // source to output, nBins per tile
+};
+
+// histograms and LUTs of one row of tiles per task
+class ClaheLutBody : public ParallelLoopBody {
+public:
+    ClaheLutBody(const Mat &img, const uchar *srcLut, Clahe &cl) :
+        img_(img), srcLut_(srcLut), cl_(cl) {}
+
+    void operator()(const Range &r) const {
+        vector<unsigned> h(cl_.tilesX*4*nBins);
+        for(int ty=r.start; ty<r.end; ty++) {
+            int y0 = ty*cl_.tileH, y1 = min(img_.rows, y0+cl_.tileH);
+            fill(h.begin(), h.end(), 0);
+            for(int y=y0; y<y1; y++) {
+                const uchar *p = img_.ptr<uchar>(y);
+                for(int tx=0; tx<cl_.tilesX; tx++) {
+                    int x0 = tx*cl_.tileW, x1 = min(img_.cols, x0+cl_.tileW);
+                    countRow(p+x0, x1-x0, (unsigned (*)[nBins])&h[tx*4*nBins]);
+                }
+            }
+
+            for(int tx=0; tx<cl_.tilesX; tx++) {
+                // fold, move to the input's gray levels, clip and equalize
+                uint64 srcHist[nBins], hist[nBins];
+                const unsigned *t = &h[tx*4*nBins];
+                for(int i=0; i<nBins; i++)
+                    srcHist[i] = (uint64)t[i]+t[nBins+i]+t[2*nBins+i]+t[3*nBins+i];
+                pushHist(srcHist, srcLut_, hist);
+
+                uint64 area = (uint64)(y1-y0)*(min(img_.cols, (tx+1)*cl_.tileW)-tx*cl_.tileW);
+                clipHist(hist, max((uint64)1, (uint64)(cl_.clip*area/nBins)));
+                uchar lut[nBins];
+                equalizeLut(hist, lut);
+                composeLut(srcLut_, lut, &cl_.luts[(ty*cl_.tilesX+tx)*nBins]);
+            }
+        }
+    }
+
+private:
+    const Mat &img_;
+    const uchar *srcLut_;
+    Clahe &cl_;
+};
+
+// bilinear blend of the tile LUTs, rows in parallel
+class ClaheApplyBody : public ParallelLoopBody {
+public:
+    ClaheApplyBody(const Mat &img, const Clahe &cl, Mat &dst) :
+        img_(img), cl_(cl), dst_(dst), tx0_(img.cols), tx1_(img.cols), fx_(img.cols) {
+        // the tile pair and weight of every column, shared by all rows
+        for(int x=0; x<img.cols; x++)
+            blendPos(x, cl.tileW, cl.tilesX, tx0_[x], tx1_[x], fx_[x]);
+    }
+
+    static void blendPos(int x, int tile, int ntiles, int &t0, int &t1, float &f) {
+        // position between tile centers
+        float t = (x+0.5f)/tile-0.5f;
+        t0 = cvFloor(t);
+        f = t-t0;
+        t1 = min(t0+1, ntiles-1);
+        t0 = max(t0, 0);
+    }
+
+    void operator()(const Range &r) const {
+        const int n = nBins;
+        for(int y=r.start; y<r.end; y++) {
+            int ty0, ty1;
+            float fy;
+            blendPos(y, cl_.tileH, cl_.tilesY, ty0, ty1, fy);
+            const uchar *top = &cl_.luts[ty0*cl_.tilesX*n];
+            const uchar *bot = &cl_.luts[ty1*cl_.tilesX*n];
+
+            const uchar *p = img_.ptr<uchar>(y);
+            uchar *d = dst_.ptr<uchar>(y);
+            for(int x=0; x<img_.cols; x++) {
+                int v = p[x];
+                int a = tx0_[x]*n+v, b = tx1_[x]*n+v;
+                float fx = fx_[x];
+                float t = top[a]+(top[b]-top[a])*fx;
+                float u = bot[a]+(bot[b]-bot[a])*fx;
+                d[x] = saturate_cast<uchar>(t+(u-t)*fy);
+            }
+        }
+    }
+
+private:
+    const Mat &img_;
+    const Clahe &cl_;
+    Mat &dst_;
+    vector<int> tx0_, tx1_;
+    vector<float> fx_;
+};
+
+void applyClahe(const Mat &srcImg, const uchar *srcLut, Clahe &cl, Mat &dst) {
+    cl.tileW = (srcImg.cols+cl.tilesX-1)/cl.tilesX;
+    cl.tileH = (srcImg.rows+cl.tilesY-1)/cl.tilesY;
+    // tiles that would start past the border are dropped
+    cl.tilesX = (srcImg.cols+cl.tileW-1)/cl.tileW;
+    cl.tilesY = (srcImg.rows+cl.tileH-1)/cl.tileH;
+    cl.luts.resize(cl.tilesX*cl.tilesY*nBins);
+
+    parallel_for_(Range(0, cl.tilesY), ClaheLutBody(srcImg, srcLut, cl));
+    dst.create(srcImg.size(), CV_8U);
+    parallel_for_(Range(0, srcImg.rows), ClaheApplyBody(srcImg, cl, dst));
+}
+
+bool parseStages(const char *list, bool *want) {
+    // comma separated stage names
+    for(int s=0; s<NSTAGES; s++)
+        want[s] = false;
+    string str = list;
+    size_t pos = 0;
+    while(pos <= str.size()) {
+        size_t end = str.find(',', pos);
+        if(end == string::npos)
+            end = str.size();
+        string name = str.substr(pos, end-pos);
+        int s = 0;
+        while(s < NSTAGES && name != stageNames[s])
+            s++;
+        if(s == NSTAGES)
+            return false;
+        want[s] = true;
+        pos = end+1;
+    }
+    return true;
+}
+
+// One run of Steps 2-4 and CLAHE with its own parameters. Settings share
+// the decoded source and its histogram, their LUTs are built up front.
+struct Setting {
+    float gamma;
+    float dfactor;
+    bool want[NSTAGES];
+    Clahe clahe;
+    uchar lut[NSTAGES][256];        // source to stage
+    uint64 hist[NSTAGES][nBins];    // histogram of each stage
+};
+
+bool parseSetting(const string &spec, Setting &st) {
+    // comma separated key=value pairs: gamma, degrade, stretch (0/1),
+    // equal (0/1), clahe (<tx>x<ty> or 0), clip
+    size_t pos = 0;
+    while(pos < spec.size()) {
+        size_t end = spec.find(',', pos);
+        if(end == string::npos)
+            end = spec.size();
+        string item = spec.substr(pos, end-pos);
+        pos = end+1;
+
+        size_t eq = item.find('=');
+        if(eq == string::npos)
+            return false;
+        string key = item.substr(0, eq);
+        const char *val = item.c_str()+eq+1;
+        if(key == "gamma")
+            st.gamma = atof(val);
+        else if(key == "degrade")
+            st.dfactor = atof(val);
+        else if(key == "stretch")
+            st.want[STAGE_STRETCH] = atoi(val) != 0;
+        else if(key == "equal")
+            st.want[STAGE_EQUAL] = atoi(val) != 0;
+        else if(key == "clip")
+            st.clahe.clip = atof(val);
+        else if(key == "clahe") {
+            st.want[STAGE_CLAHE] = strcmp(val, "0") != 0;
+            if(st.want[STAGE_CLAHE] && (sscanf(val, "%dx%d", &st.clahe.tilesX, &st.clahe.tilesY) != 2 \
+                || st.clahe.tilesX <= 0 || st.clahe.tilesY <= 0))
+                return false;
+        }
+        else
+            return false;
+    }
+    return st.gamma > 0 && st.dfactor >= 0;
+}
+
+bool buildLuts(Setting &st, const uint64 *srcHist) {
+    // Steps 2-4 on 256 entries, no pixel is read
+    for(int i=0; i<nBins; i++)
+        st.hist[STAGE_SRC][i] = srcHist[i];
+    for(int i=0; i<256; i++)
+        st.lut[STAGE_SRC][i] = i;
 
-    // load image
-    srcImg = imread(argv[1], 0);
-    assert(srcImg.data);
-    
-    // Step1: draw histogram
-    calcHist(&srcImg, 1, 0, Mat(), hist, 1, &nBins, &histRange);
-    genHistImg(hist, histImg);
-    imwrite("src_hist.jpg", histImg);
-    
     /// Step2-1: gamma transformation
-    Mat gammaImg;
-    
-    // build look-up table (lut)
-    Mat lut(256,1,CV_8U,Scalar(0));
-    float gamma = 2.5f;
     for(int i=0; i<256; i++)
-        lut.at<uchar>(i) = pow(((float)i/256.0f), gamma)*256.0f;
-    
-    gammaImg = srcImg.clone();
-    LUT(srcImg, lut, gammaImg);
-    
-    calcHist(&gammaImg, 1, 0, Mat(), hist, 1, &nBins, &histRange);
-    genHistImg(hist, histImg);
-    
-    imwrite("gamma.jpg", gammaImg);
-    imwrite("gamma_hist.jpg", histImg);
-    
+        st.lut[STAGE_GAMMA][i] = pow(((float)i/256.0f), st.gamma)*256.0f;
+    pushHist(srcHist, st.lut[STAGE_GAMMA], st.hist[STAGE_GAMMA]);
+
     // Step2-2: degration
-    Mat degImg;
-    
-    // build look-up table
-    lut.setTo(Scalar(0));
-    float dfactor = 0.6f;
+    uchar step[256];
     for(int i=0; i<256; i++)
-        lut.at<uchar>(i) = (float)i*dfactor;
-    
-    degImg = gammaImg.clone();
-    LUT(gammaImg, lut, degImg);
-    calcHist(&degImg, 1, 0, Mat(), hist, 1, &nBins, &histRange);
-    genHistImg(hist, histImg);
-
-    imwrite("degrad.jpg", degImg);
-    imwrite("degrad_hist.jpg", histImg);
-    
-    
-    // Step3: histogram stretch
-    Mat strImg;
-    
-    // build look-up table
-    lut.setTo(Scalar(0));
-    
+        step[i] = saturate_cast<uchar>((int)((float)i*st.dfactor));
+    composeLut(st.lut[STAGE_GAMMA], step, st.lut[STAGE_DEGRAD]);
+    pushHist(srcHist, st.lut[STAGE_DEGRAD], st.hist[STAGE_DEGRAD]);
+
+    // Step3: histogram stretch of the degraded image
+    const uint64 *degHist = st.hist[STAGE_DEGRAD];
+
     // find r_min and r_max
     int r_min = 0;
     int r_max = 255;
     for(int i=0; i<256; i++) {
-        if(hist.at<float>(i) > 0.0f)
+        if(degHist[i] > 0)
             break;
         r_min = i;
     }
 
     for(int i=255; i>=0; i--) {
-        if(hist.at<float>(i) > 0.0f)
+        if(degHist[i] > 0)
             break;
         r_max = i;
     }
-    assert(r_max > r_min);
-    
+    if(r_max <= r_min)
+        return false;
+
     for(int i=0; i<256; i++) {
         if(i<=r_min)
-            lut.at<uchar>(i) = 0;
+            step[i] = 0;
         else if(i>r_max)
-            lut.at<uchar>(i) = 255;
+            step[i] = 255;
         else
-            lut.at<uchar>(i) = 255.0f*((float)(i-r_min))/((float)(r_max-r_min));
-    }
-    
-    strImg = degImg.clone();
-    LUT(degImg, lut, strImg);   
-    
-    calcHist(&strImg, 1, 0, Mat(), hist, 1, &nBins, &histRange);
-    genHistImg(hist, histImg);
-    
-    imwrite("stretch.jpg", strImg);
-    imwrite("stretch_hist.jpg", histImg);
-    
-    // Step4: Histogram Equalization
-    Mat equImg;
-    
-    // take degImg as input
-    calcHist(&degImg, 1, 0, Mat(), hist, 1, &nBins, &histRange);
-    
+            step[i] = 255.0f*((float)(i-r_min))/((float)(r_max-r_min));
+    }
+    composeLut(st.lut[STAGE_DEGRAD], step, st.lut[STAGE_STRETCH]);
+    pushHist(srcHist, st.lut[STAGE_STRETCH], st.hist[STAGE_STRETCH]);
+
+    // Step4: Histogram Equalization of the degraded image
+
     // obtain the CDF function (lut)
-    // CDF function is the transformation function
-    int npixels = degImg.rows*degImg.cols;
-    float factor = 255.0f/(float)npixels;
-    
-    lut.setTo(Scalar(0));
-    lut.convertTo(lut, CV_32F);
-    
-    int sum = 0;
+    equalizeLut(degHist, step);
+    composeLut(st.lut[STAGE_DEGRAD], step, st.lut[STAGE_EQUAL]);
+    pushHist(srcHist, st.lut[STAGE_EQUAL], st.hist[STAGE_EQUAL]);
+    return true;
+}
+
+string outputName(const string &pattern, const Setting &st, int idx, int stage) {
+    // fill in {stage}, {i}, {gamma} and {degrade}
+    char buf[32];
+    string name;
+    for(size_t p=0; p<pattern.size(); ) {
+        size_t end = pattern.find('}', p);
+        if(pattern[p] != '{' || end == string::npos) {
+            name += pattern[p++];
+            continue;
+        }
+        string key = pattern.substr(p+1, end-p-1);
+        if(key == "stage")
+            name += stageNames[stage];
+        else if(key == "i")
+            name += (sprintf(buf, "%d", idx), buf);
+        else if(key == "gamma")
+            name += (sprintf(buf, "%g", st.gamma), buf);
+        else if(key == "degrade")
+            name += (sprintf(buf, "%g", st.dfactor), buf);
+        else
+            name += pattern.substr(p, end-p+1);
+        p = end+1;
+    }
+    return name;
+}
+
+enum StatsFormat { STATS_NONE, STATS_JSON, STATS_BIN };
+
+// percentiles reported by writeStats()
+const int percents[] = {1, 5, 25, 50, 75, 95, 99};
+const int npercents = sizeof(percents)/sizeof(percents[0]);
+
+bool writeStats(const string &path, const char *stage, const uint64 *hist, int format) {
+    // counts, CDF and summary numbers of one histogram, straight from the bins
+    uint64 cdf[nBins], n = 0;
+    double mean = 0;
+    for(int i=0; i<nBins; i++) {
+        n += hist[i];
+        cdf[i] = n;
+        mean += (double)i*hist[i];
+    }
+    int rmin = 0, rmax = nBins-1;
+    while(rmin < rmax && hist[rmin] == 0)
+        rmin++;
+    while(rmax > rmin && hist[rmax] == 0)
+        rmax--;
+
+    double entropy = 0;
     for(int i=0; i<nBins; i++) {
-        sum += hist.at<float>(i);
-        lut.at<float>(i)=roundf(factor*sum);
-    }
-    
-    lut.convertTo(lut, CV_8U);
-    
-    
-    equImg = degImg.clone();
-    LUT(degImg, lut, equImg);
-    calcHist(&equImg, 1, 0, Mat(), hist, 1, &nBins, &histRange);
-    
-    genHistImg(hist, histImg);
-    
-    imwrite("equal.jpg", equImg);
-    imwrite("equal_hist.jpg", histImg);
-    
+        if(hist[i]) {
+            double p = (double)hist[i]/n;
+            entropy -= p*log2(p);
+        }
+    }
+    mean = n ? mean/n : 0;
+
+    // smallest level with at least p% of the pixels at or below it
+    int pct[npercents];
+    for(int k=0, i=0; k<npercents; k++) {
+        uint64 need = (n*percents[k]+99)/100;
+        while(i < nBins-1 && cdf[i] < need)
+            i++;
+        pct[k] = i;
+    }
+
+    FILE *fp = fopen(path.c_str(), format == STATS_BIN ? "wb" : "w");
+    if(!fp)
+        return false;
+    if(format == STATS_BIN) {
+        // see README for the layout, host byte order
+        int ints[2+npercents] = {rmin, rmax};
+        for(int k=0; k<npercents; k++)
+            ints[2+k] = pct[k];
+        double reals[2] = {mean, entropy};
+        fwrite("HST1", 1, 4, fp);
+        fwrite(&n, sizeof(n), 1, fp);
+        fwrite(ints, sizeof(ints), 1, fp);
+        fwrite(reals, sizeof(reals), 1, fp);
+        fwrite(hist, sizeof(uint64), nBins, fp);
+        fwrite(cdf, sizeof(uint64), nBins, fp);
+    }
+    else {
+        fprintf(fp, "{\n  \"stage\": \"%s\",\n  \"pixels\": %llu,\n", stage, (unsigned long long)n);
+        fprintf(fp, "  \"r_min\": %d,\n  \"r_max\": %d,\n", rmin, rmax);
+        fprintf(fp, "  \"mean\": %.6f,\n  \"entropy\": %.6f,\n", mean, entropy);
+        fprintf(fp, "  \"percentiles\": {");
+        for(int k=0; k<npercents; k++)
+            fprintf(fp, "%s\"%d\": %d", k ? ", " : "", percents[k], pct[k]);
+        fprintf(fp, "},\n  \"bins\": [");
+        for(int i=0; i<nBins; i++)
+            fprintf(fp, "%s%llu", i ? "," : "", (unsigned long long)hist[i]);
+        fprintf(fp, "],\n  \"cdf\": [");
+        for(int i=0; i<nBins; i++)
+            fprintf(fp, "%s%llu", i ? "," : "", (unsigned long long)cdf[i]);
+        fprintf(fp, "]\n}\n");
+    }
+    return fclose(fp) == 0;
+}
+
+// one output stage of one setting
+struct OutputJob {
+    int setting;
+    int stage;
+};
+
+// writes the stage images and histogram plots, all jobs in parallel on the
+// shared source image
+class OutputBody : public ParallelLoopBody {
+public:
+    OutputBody(const Mat &srcImg, vector<Setting> &settings, const vector<OutputJob> &jobs,
+        const string &pattern, bool plots, int stats) :
+        srcImg_(srcImg), settings_(settings), jobs_(jobs), pattern_(pattern), plots_(plots),
+        stats_(stats) {}
+
+    void operator()(const Range &r) const {
+        Mat dstImg;
+        Mat histImg(hist_h, hist_w, CV_8U, Scalar(0));    // visualize histogram
+        for(int j=r.start; j<r.end; j++) {
+            Setting &st = settings_[jobs_[j].setting];
+            int s = jobs_[j].stage;
+            string name = outputName(pattern_, st, jobs_[j].setting, s);
+
+            // CLAHE (of the degraded image, like Step4) reads the source for
+            // the tile histograms and to blend, then once more for its
+            // histogram; the other stages are one LUT pass
+            if(s == STAGE_CLAHE) {
+                applyClahe(srcImg_, st.lut[STAGE_DEGRAD], st.clahe, dstImg);
+                if(plots_ || stats_)
+                    calcHist64(dstImg, st.hist[s]);
+                imwrite(name + ".jpg", dstImg);
+            }
+            else if(s != STAGE_SRC) {
+                LUT(srcImg_, Mat(256, 1, CV_8U, st.lut[s]), dstImg);
+                imwrite(name + ".jpg", dstImg);
+            }
+            if(stats_) {
+                string path = name + (stats_ == STATS_BIN ? "_stats.bin" : "_stats.json");
+                if(!writeStats(path, stageNames[s], st.hist[s], stats_))
+                    printf("Cannot write %s.\n", path.c_str());
+            }
+            else if(plots_) {
+                genHistImg(st.hist[s], histImg);
+                imwrite(name + "_hist.jpg", histImg);
+            }
+        }
+    }
+
+private:
+    const Mat &srcImg_;
+    vector<Setting> &settings_;
+    const vector<OutputJob> &jobs_;
+    const string &pattern_;
+    bool plots_;
+    int stats_;
+};
+
+void usage() {
+    printf("usage: hist <image path> [--only <stage>,...] [--gamma <g>] [--degrade <d>]\n");
+    printf("            [--clahe <tx>x<ty>] [--clip <c>] [--set <setting>]... [--sweep <file>]\n");
+    printf("            [--name <pattern>] [--no-plots] [--stats json|bin]\n");
+    printf("<stage>: src, gamma, degrad, stretch, equal, clahe\n");
+    printf("<setting>: gamma=<g>,degrade=<d>,stretch=0|1,equal=0|1,clahe=<tx>x<ty>|0,clip=<c>\n");
+    printf("<pattern>: output name without extension, {stage} {i} {gamma} {degrade} are filled in\n");
+}
+
+int main(int argc, char** argv)
+{
+    if(argc < 2) {
+        usage();
+        return -1;
+    }
+
+    // the options set the defaults every setting starts from
+    Setting base;
+    base.gamma = 2.5f;
+    base.dfactor = 0.6f;
+    bool want[NSTAGES] = {true, true, true, true, true, false};
+    base.clahe.tilesX = base.clahe.tilesY = 8;
+    base.clahe.clip = 4.0;
+    const char *only = 0;
+    string pattern;
+    bool plots = true;
+    int stats = STATS_NONE;
+    vector<string> specs;
+
+    for(int a=2; a<argc; a++) {
+        if(!strcmp(argv[a], "--only") && a+1<argc)
+            only = argv[++a];
+        else if(!strcmp(argv[a], "--gamma") && a+1<argc)
+            base.gamma = atof(argv[++a]);
+        else if(!strcmp(argv[a], "--degrade") && a+1<argc)
+            base.dfactor = atof(argv[++a]);
+        else if(!strcmp(argv[a], "--clahe") && a+1<argc) {
+            want[STAGE_CLAHE] = true;
+            int n = sscanf(argv[++a], "%dx%d", &base.clahe.tilesX, &base.clahe.tilesY);
+            if(n != 2 || base.clahe.tilesX <= 0 || base.clahe.tilesY <= 0) {
+                usage();
+                return -1;
+            }
+        }
+        else if(!strcmp(argv[a], "--clip") && a+1<argc)
+            base.clahe.clip = atof(argv[++a]);
+        else if(!strcmp(argv[a], "--set") && a+1<argc)
+            specs.push_back(argv[++a]);
+        else if(!strcmp(argv[a], "--sweep") && a+1<argc) {
+            // one setting per line, # comments
+            ifstream in(argv[++a]);
+            if(!in) {
+                printf("Cannot read %s.\n", argv[a]);
+                return -1;
+            }
+            string line;
+            while(getline(in, line))
+                if(!line.empty() && line[0] != '#')
+                    specs.push_back(line);
+        }
+        else if(!strcmp(argv[a], "--name") && a+1<argc)
+            pattern = argv[++a];
+        else if(!strcmp(argv[a], "--no-plots"))
+            plots = false;
+        else if(!strcmp(argv[a], "--stats") && a+1<argc) {
+            // numbers instead of the plots
+            a++;
+            stats = !strcmp(argv[a], "json") ? STATS_JSON : !strcmp(argv[a], "bin") ? STATS_BIN : -1;
+            if(stats < 0) {
+                usage();
+                return -1;
+            }
+            plots = false;
+        }
+        else {
+            usage();
+            return -1;
+        }
+    }
+    if(only && !parseStages(only, want)) {
+        usage();
+        return -1;
+    }
+    for(int s=0; s<NSTAGES; s++)
+        base.want[s] = want[s];
+
+    vector<Setting> settings;
+    if(specs.empty())
+        settings.push_back(base);
+    for(size_t i=0; i<specs.size(); i++) {
+        settings.push_back(base);
+        if(!parseSetting(specs[i], settings.back())) {
+            printf("Bad setting \"%s\".\n", specs[i].c_str());
+            usage();
+            return -1;
+        }
+    }
+    // the original fixed names for a single run
+    if(pattern.empty())
+        pattern = specs.empty() ? "{stage}" : "{stage}_{i}";
+
+    Mat srcImg;     // source image
+    uint64 srcHist[nBins];
+
+    // load image, decoded once for every setting
+    srcImg = imread(argv[1], 0);
+    assert(srcImg.data);
+
+    // Step1: histogram, the only pass over the pixels before the outputs
+    calcHist64(srcImg, srcHist);
+
+    // all LUTs first, then every requested output of every setting in parallel
+    vector<OutputJob> jobs;
+    for(size_t i=0; i<settings.size(); i++) {
+        Setting &st = settings[i];
+        if(!buildLuts(st, srcHist)) {
+            printf("setting %d: the degraded image is flat, no stretch or equalization.\n", (int)i);
+            st.want[STAGE_STRETCH] = st.want[STAGE_EQUAL] = st.want[STAGE_CLAHE] = false;
+        }
+        // the source histogram is the same for all settings
+        for(int s=(i == 0 ? 0 : 1); s<NSTAGES; s++) {
+            if(st.want[s] && (s != STAGE_SRC || plots || stats)) {
+                OutputJob job = {(int)i, s};
+                jobs.push_back(job);
+            }
+        }
+    }
+    parallel_for_(Range(0, (int)jobs.size()), OutputBody(srcImg, settings, jobs, pattern, plots, stats));
+
     return 0;
-    
+
 }
@@ -1,40 +1,341 @@
 #include <cstdio>
+#include <cstdlib>
+#include <cstring>
 #include <cassert>
 #include <string>
 #include <sstream>
+#include <vector>
+#include <algorithm>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
 
 #include <opencv2/opencv.hpp>
 
 using namespace std;
 using namespace cv;
 
+// least rows per band, each band primes its own column sums
+#define UNSHARP_BAND_ROWS 64
+// sharpened outputs made per pass over the mask
+#define UNSHARP_GROUP 4
+
+void updateColumns(int *sum, const uchar *add, const uchar *sub, int n) {
+    // column sums gain one row and lose another
+    int x = 0;
+#if CV_SSE2
+    __m128i z = _mm_setzero_si128();
+    for(; x <= n-16; x += 16) {
+        __m128i a = _mm_loadu_si128((const __m128i*)(add+x));
+        __m128i b = _mm_loadu_si128((const __m128i*)(sub+x));
+        __m128i d0 = _mm_sub_epi16(_mm_unpacklo_epi8(a, z), _mm_unpacklo_epi8(b, z));
+        __m128i d1 = _mm_sub_epi16(_mm_unpackhi_epi8(a, z), _mm_unpackhi_epi8(b, z));
+        __m128i *s = (__m128i*)(sum+x);
+        _mm_storeu_si128(s, _mm_add_epi32(_mm_loadu_si128(s), _mm_srai_epi32(_mm_unpacklo_epi16(d0, d0), 16)));
+        _mm_storeu_si128(s+1, _mm_add_epi32(_mm_loadu_si128(s+1), _mm_srai_epi32(_mm_unpackhi_epi16(d0, d0), 16)));
+        _mm_storeu_si128(s+2, _mm_add_epi32(_mm_loadu_si128(s+2), _mm_srai_epi32(_mm_unpacklo_epi16(d1, d1), 16)));
+        _mm_storeu_si128(s+3, _mm_add_epi32(_mm_loadu_si128(s+3), _mm_srai_epi32(_mm_unpackhi_epi16(d1, d1), 16)));
+    }
+#endif
+    for(; x < n; x++)
+        sum[x] += add[x]-sub[x];
+}
+
+void fuseRow(const uchar *src, const int *box, float scale, float k, \
+    uchar *smooth, short *mask, uchar *dst, int n) {
+    // box average, signed mask and src + k*mask for one row; rounding is
+    // the same as boxFilter's and addWeighted's
+    int x = 0;
+#if CV_SSE2
+    __m128 s4 = _mm_set1_ps(scale), k4 = _mm_set1_ps(k);
+    __m128i z = _mm_setzero_si128();
+    for(; x <= n-8; x += 8) {
+        __m128i a0 = _mm_cvtps_epi32(_mm_mul_ps(_mm_cvtepi32_ps(_mm_loadu_si128((const __m128i*)(box+x))), s4));
+        __m128i a1 = _mm_cvtps_epi32(_mm_mul_ps(_mm_cvtepi32_ps(_mm_loadu_si128((const __m128i*)(box+x+4))), s4));
+        __m128i avg = _mm_packs_epi32(a0, a1);
+        __m128i p = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*)(src+x)), z);
+        __m128i m = _mm_sub_epi16(p, avg);
+        _mm_storel_epi64((__m128i*)(smooth+x), _mm_packus_epi16(avg, avg));
+        _mm_storeu_si128((__m128i*)(mask+x), m);
+
+        __m128 m0 = _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpacklo_epi16(m, m), 16));
+        __m128 m1 = _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpackhi_epi16(m, m), 16));
+        __m128 p0 = _mm_cvtepi32_ps(_mm_unpacklo_epi16(p, z));
+        __m128 p1 = _mm_cvtepi32_ps(_mm_unpackhi_epi16(p, z));
+        __m128i d = _mm_packs_epi32(_mm_cvtps_epi32(_mm_add_ps(p0, _mm_mul_ps(m0, k4))), \
+            _mm_cvtps_epi32(_mm_add_ps(p1, _mm_mul_ps(m1, k4))));
+        _mm_storel_epi64((__m128i*)(dst+x), _mm_packus_epi16(d, d));
+    }
+#endif
+    for(; x < n; x++) {
+        int avg = cvRound(box[x]*scale);
+        int m = src[x]-avg;
+        smooth[x] = (uchar)avg;
+        mask[x] = (short)m;
+        dst[x] = saturate_cast<uchar>(src[x] + m*k);
+    }
+}
+
+void sharpenRow(const uchar *src, const short *mask, float k, uchar *dst, int n) {
+    // src + k*mask for one row, rounded like fuseRow()
+    int x = 0;
+#if CV_SSE2
+    __m128 k4 = _mm_set1_ps(k);
+    __m128i z = _mm_setzero_si128();
+    for(; x <= n-8; x += 8) {
+        __m128i p = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*)(src+x)), z);
+        __m128i m = _mm_loadu_si128((const __m128i*)(mask+x));
+        __m128 m0 = _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpacklo_epi16(m, m), 16));
+        __m128 m1 = _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpackhi_epi16(m, m), 16));
+        __m128 p0 = _mm_cvtepi32_ps(_mm_unpacklo_epi16(p, z));
+        __m128 p1 = _mm_cvtepi32_ps(_mm_unpackhi_epi16(p, z));
+        __m128i d = _mm_packs_epi32(_mm_cvtps_epi32(_mm_add_ps(p0, _mm_mul_ps(m0, k4))), \
+            _mm_cvtps_epi32(_mm_add_ps(p1, _mm_mul_ps(m1, k4))));
+        _mm_storel_epi64((__m128i*)(dst+x), _mm_packus_epi16(d, d));
+    }
+#endif
+    for(; x < n; x++)
+        dst[x] = saturate_cast<uchar>(src[x] + mask[x]*k);
+}
+
+// Box filter and unsharp masking fused over bands of rows. Column sums
+// move down by one row in and one row out, a running sum along them gives
+// each box total, so the cost per pixel does not depend on the kernel size.
+// Borders are reflected like boxFilter's default.
+class UnsharpBody : public ParallelLoopBody {
+public:
+    UnsharpBody(const Mat &src, int ksize, int bandRows, float k, Mat &smooth, Mat &mask, Mat &dst) :
+        src_(src), r_(ksize/2), bandRows_(bandRows), scale_(1.f/(ksize*ksize)), k_(k),
+        smooth_(smooth), mask_(mask), dst_(dst), zeros_(src.cols, 0) {
+        xofs_.resize(src.cols+2*r_);
+        for(size_t j=0; j<xofs_.size(); j++)
+            xofs_[j] = borderInterpolate((int)j-r_, src.cols, BORDER_REFLECT_101);
+    }
+
+    void operator()(const Range &range) const {
+        int w = src_.cols, h = src_.rows, d = 2*r_;
+        int y0 = range.start*bandRows_, y1 = min(h, range.end*bandRows_);
+        vector<int> colSum(w, 0), box(w);
+        const int *xofs = &xofs_[0];
+
+        for(int i=y0-r_; i<=y0+r_; i++)
+            updateColumns(&colSum[0], src_.ptr(row(i)), &zeros_[0], w);
+
+        for(int y=y0; y<y1; y++) {
+            if(y > y0)
+                updateColumns(&colSum[0], src_.ptr(row(y+r_)), src_.ptr(row(y-r_-1)), w);
+
+            int s = 0;
+            for(int j=0; j<=d; j++)
+                s += colSum[xofs[j]];
+            box[0] = s;
+            for(int x=1; x<w; x++) {
+                s += colSum[xofs[x+d]] - colSum[xofs[x-1]];
+                box[x] = s;
+            }
+
+            fuseRow(src_.ptr(y), &box[0], scale_, k_, smooth_.ptr(y), mask_.ptr<short>(y), dst_.ptr(y), w);
+        }
+    }
+
+private:
+    int row(int y) const {
+        return borderInterpolate(y, src_.rows, BORDER_REFLECT_101);
+    }
+
+    const Mat &src_;
+    int r_, bandRows_;
+    float scale_, k_;
+    Mat &smooth_, &mask_, &dst_;
+    vector<int> xofs_;
+    vector<uchar> zeros_;
+};
+
+void unsharp(const Mat &srcImg, int ksize, float k, Mat &smoothImg, Mat &maskImg, Mat &dstImg) {
+    smoothImg.create(srcImg.size(), CV_8U);
+    maskImg.create(srcImg.size(), CV_16S);
+    dstImg.create(srcImg.size(), CV_8U);
+    int bandRows = max(UNSHARP_BAND_ROWS, 2*ksize);
+    int nbands = (srcImg.rows + bandRows-1)/bandRows;
+    parallel_for_(Range(0, nbands), UnsharpBody(srcImg, ksize, bandRows, k, smoothImg, maskImg, dstImg));
+}
+
+// Several factors over one mask: each row of source and mask is read once
+// for all the outputs of the group.
+class SharpenBody : public ParallelLoopBody {
+public:
+    SharpenBody(const Mat &src, const Mat &mask, const float *ks, int n, vector<Mat> &dst) :
+        src_(src), mask_(mask), ks_(ks), n_(n), dst_(dst) {}
+
+    void operator()(const Range &range) const {
+        for(int y=range.start; y<range.end; y++) {
+            const uchar *src = src_.ptr(y);
+            const short *mask = mask_.ptr<short>(y);
+            for(int i=0; i<n_; i++)
+                sharpenRow(src, mask, ks_[i], dst_[i].ptr(y), src_.cols);
+        }
+    }
+
+private:
+    const Mat &src_, &mask_;
+    const float *ks_;
+    int n_;
+    vector<Mat> &dst_;
+};
+
+// Writes images on background threads so the encoding overlaps the next
+// pass; push() blocks while cap images are waiting.
+class Encoder {
+public:
+    Encoder(int threads, size_t cap) : cap_(cap), closed_(false), failed_(0) {
+        for(int i=0; i<max(1, threads); i++)
+            workers_.push_back(thread(&Encoder::run, this));
+    }
+
+    void push(const string &name, const Mat &img) {
+        unique_lock<mutex> lock(m_);
+        notFull_.wait(lock, [this] { return q_.size() < cap_; });
+        q_.push_back(make_pair(name, img));
+        notEmpty_.notify_one();
+    }
+
+    // waits for the queued images, returns how many could not be written
+    int finish() {
+        {
+            lock_guard<mutex> lock(m_);
+            closed_ = true;
+            notEmpty_.notify_all();
+        }
+        for(size_t i=0; i<workers_.size(); i++)
+            workers_[i].join();
+        return failed_;
+    }
+
+private:
+    void run() {
+        for(;;) {
+            pair<string, Mat> job;
+            {
+                unique_lock<mutex> lock(m_);
+                notEmpty_.wait(lock, [this] { return !q_.empty() || closed_; });
+                if(q_.empty())
+                    return;
+                job = q_.front();
+                q_.pop_front();
+                notFull_.notify_one();
+            }
+            if(!imwrite(job.first, job.second)) {
+                lock_guard<mutex> lock(m_);
+                printf("Cannot write %s.\n", job.first.c_str());
+                failed_++;
+            }
+        }
+    }
+
+    size_t cap_;
+    bool closed_;
+    int failed_;
+    deque<pair<string, Mat> > q_;
+    vector<thread> workers_;
+    mutex m_;
+    condition_variable notFull_, notEmpty_;
+};
+
+bool parseFactors(const char *arg, vector<float> &ks) {
+    // <k>,<k>,... or an inclusive range <first>:<last>:<step>
+    float first, last, step;
+    char c;
+    if(sscanf(arg, "%f:%f:%f%c", &first, &last, &step, &c) == 3) {
+        if(step <= 0 || last < first)
+            return false;
+        for(int i=0; first + i*step <= last + step*1e-3f; i++)
+            ks.push_back(first + i*step);
+        return true;
+    }
+    const char *p = arg;
+    for(;;) {
+        char *end;
+        float k = (float)strtod(p, &end);
+        if(end == p || (*end && *end != ','))
+            return false;
+        ks.push_back(k);
+        if(!*end)
+            return true;
+        p = end+1;
+    }
+}
+
+string outputName(float k) {
+    ostringstream buff;
+    buff << "unsharp_" << k << ".jpg";
+    return buff.str();
+}
+
+void usage() {
+    printf("usage: unsharp <image path> <factors> [--ksize <n>] [--io-threads <n>]\n");
+    printf("<factors>: one or more k, as <k>,<k>,... or <first>:<last>:<step>\n");
+    printf("--ksize: odd size of the box filter (default: 5)\n");
+    printf("--io-threads: threads writing the images (default: 2)\n");
+}
+
 int main(int argc, char** argv)
 {
-    assert(argc == 3);
-    
+    if(argc < 3) {
+        usage();
+        return -1;
+    }
+    int ksize = 5, ioThreads = 2;
+    vector<float> ks;
+    for(int a=2; a<argc; a++) {
+        if(!strcmp(argv[a], "--ksize") && a+1<argc)
+            ksize = atoi(argv[++a]);
+        else if(!strcmp(argv[a], "--io-threads") && a+1<argc)
+            ioThreads = atoi(argv[++a]);
+        else if(!parseFactors(argv[a], ks)) {
+            usage();
+            return -1;
+        }
+    }
+    if(ks.empty()) {
+        usage();
+        return -1;
+    }
+    if(ksize < 1 || ksize % 2 == 0) {
+        printf("Kernel size must be odd and positive.\n");
+        return -1;
+    }
+
     Mat srcImg, smoothImg;
-    Mat maskImg;
-    
+    Mat maskImg, dstImg;
+
     // load image
     srcImg = imread(argv[1], 0);
     assert(srcImg.data);
-    
-    // 6.1: smoothing with 5x5 box filter
-    boxFilter(srcImg, smoothImg, -1, Size(5,5));
-    imwrite("smooth.jpg", smoothImg);
-    
-    // 6.2: create unsharp masking image
-    assert(srcImg.size == smoothImg.size);
-    subtract(srcImg, smoothImg, maskImg);
-    imwrite("mask.jpg", maskImg);
-    
-    // 6.3: unsharp masking
-    float k = atof(argv[2]);
-    Mat dstImg = srcImg + k*maskImg;
-    
-    ostringstream buff;
-    buff << "unsharp_" << k << ".jpg";
-    imwrite(buff.str(), dstImg);
-    
-    return 0;
+
+    // at most two groups wait for the encoders
+    Encoder encoder(ioThreads, 2*UNSHARP_GROUP);
+
+    // 6.1 - 6.3 in one pass: box filter, signed mask, src + k*mask
+    unsharp(srcImg, ksize, ks[0], smoothImg, maskImg, dstImg);
+    encoder.push("smooth.jpg", smoothImg);
+    encoder.push(outputName(ks[0]), dstImg);
+
+    // the mask is signed, shown around mid-gray
+    Mat maskView;
+    maskImg.convertTo(maskView, CV_8U, 1, 128);
+    encoder.push("mask.jpg", maskView);
+
+    // the other factors reuse the mask, a group of them per pass
+    for(size_t g=1; g<ks.size(); g+=UNSHARP_GROUP) {
+        int n = (int)min(ks.size()-g, (size_t)UNSHARP_GROUP);
+        vector<Mat> outs(n);
+        for(int i=0; i<n; i++)
+            outs[i].create(srcImg.size(), CV_8U);
+        parallel_for_(Range(0, srcImg.rows), SharpenBody(srcImg, maskImg, &ks[g], n, outs));
+        for(int i=0; i<n; i++)
+            encoder.push(outputName(ks[g+i]), outs[i]);
+    }
+
+    return encoder.finish() ? -1 : 0;
 }
@@ -0,0 +1,156 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+#include <algorithm>
+#include <opencv2/opencv.hpp>
+#include "fft.h"
+
+using namespace std;
+using namespace cv;
+
+static void usage() {
+    printf("usage: fft_bench [--threads N] [--min-time S] [--max-side N] [--out <file.json>]\n");
+    printf("--threads N: threads for both FFTs (default: all cores)\n");
+    printf("--min-time S: run each case for at least S seconds (default: 0.2)\n");
+    printf("--max-side N: skip sizes with a longer side (default: 8192)\n");
+    printf("--out: write the JSON there instead of stdout\n");
+}
+
+template<typename F>
+static double timeIt(F fn, double minTime, int &iters) {
+    // mean ms per call over at least minTime seconds, after one warm-up
+    fn();
+    double total = 0;
+    iters = 0;
+    while(total < minTime*1000 || iters < 3) {
+        double t0 = (double)getTickCount();
+        fn();
+        total += ((double)getTickCount()-t0)*1000.0/getTickFrequency();
+        iters++;
+    }
+    return total/iters;
+}
+
+int main(int argc, char** argv) {
+    int threads = getNumberOfCPUs();
+    double minTime = 0.2;
+    int maxSide = 8192;
+    const char *out = 0;
+    for(int a = 1; a < argc; a++) {
+        if(!strcmp(argv[a], "--threads") && a+1 < argc)
+            threads = atoi(argv[++a]);
+        else if(!strcmp(argv[a], "--min-time") && a+1 < argc)
+            minTime = atof(argv[++a]);
+        else if(!strcmp(argv[a], "--max-side") && a+1 < argc)
+            maxSide = atoi(argv[++a]);
+        else if(!strcmp(argv[a], "--out") && a+1 < argc)
+            out = argv[++a];
+        else {
+            usage();
+            return -1;
+        }
+    }
+    if(threads < 1) {
+        usage();
+        return -1;
+    }
+    // same number of threads on both sides
+    setNumThreads(threads);
+
+    FILE *fp = out ? fopen(out, "w") : stdout;
+    if(!fp) {
+        printf("Cannot write %s.\n", out);
+        return -1;
+    }
+
+    // google-benchmark style layout: run context, then one entry per case
+    fprintf(fp, "{\n  \"context\": {\n");
+    fprintf(fp, "    \"threads\": %d,\n", threads);
+    fprintf(fp, "    \"opencv_version\": \"%s\",\n", CV_VERSION);
+    fprintf(fp, "    \"min_time\": %g\n  },\n", minTime);
+    fprintf(fp, "  \"benchmarks\": [");
+
+    // powers of two, and 1080p whose sides take radix 3 and 5 stages
+    const Size sizes[] = { Size(1024, 1024), Size(1920, 1080), Size(4096, 4096), Size(8192, 8192) };
+    bool first = true;
+
+    for(size_t z = 0; z < sizeof(sizes)/sizeof(sizes[0]); z++) {
+        Size size = sizes[z];
+        if(max(size.width, size.height) > maxSide)
+            continue;
+
+        // an 8-bit image as real part, zero imaginary part, as FreqFilter
+        // feeds both FFTs
+        Mat img(size, CV_32F), src;
+        randu(img, Scalar::all(0), Scalar::all(256));
+        Mat planes[] = {img, Mat::zeros(size, CV_32F)};
+        merge(planes, 2, src);
+        planes[1] = Mat();
+
+        // forward and inverse, what one filter pass costs; ours transforms
+        // in place, so it starts from a fresh copy like FreqFilter fills one
+        Fft2D fft;
+        fft.init(size);
+        Mat work, specT, spec, back, ccs;
+        int iters, cvIters, cvRealIters;
+        double ms = timeIt([&] {
+            src.copyTo(work);
+            fft.forward(work, specT);
+            fft.inverse(specT, work);
+        }, minTime, iters);
+        double cvMs = timeIt([&] {
+            dft(src, spec);
+            idft(spec, back);
+        }, minTime, cvIters);
+        // the real input path FreqFilter takes by default with dft()
+        double cvRealMs = timeIt([&] {
+            dft(img, ccs);
+            dft(ccs, back, DFT_INVERSE | DFT_REAL_OUTPUT);
+        }, minTime, cvRealIters);
+
+        // accuracy of the forward transform against dft(), relative to the
+        // largest spectrum component
+        src.copyTo(work);
+        fft.forward(work, specT);
+        dft(src, spec);
+        double maxDiff = 0, maxAbs = 0;
+        for(int y = 0; y < size.height; y++) {
+            const float *c = spec.ptr<float>(y);
+            for(int x = 0; x < size.width; x++) {
+                const float *o = specT.ptr<float>(x) + 2*y;
+                maxDiff = max(maxDiff, (double)max(fabs(o[0]-c[2*x]), fabs(o[1]-c[2*x+1])));
+                maxAbs = max(maxAbs, (double)max(fabs(c[2*x]), fabs(c[2*x+1])));
+            }
+        }
+        double relErr = maxDiff/maxAbs;
+
+        char name[64];
+        snprintf(name, sizeof(name), "fft/%dx%d", size.width, size.height);
+        double pixels = (double)size.area();
+        fprintf(fp, "%s\n    {\n", first ? "" : ",");
+        fprintf(fp, "      \"name\": \"%s\",\n", name);
+        fprintf(fp, "      \"width\": %d,\n      \"height\": %d,\n", size.width, size.height);
+        fprintf(fp, "      \"iterations\": %d,\n", iters);
+        fprintf(fp, "      \"real_time_ms\": %.6f,\n", ms);
+        fprintf(fp, "      \"ns_per_pixel\": %.4f,\n", ms*1e6/pixels);
+        fprintf(fp, "      \"cv_iterations\": %d,\n", cvIters);
+        fprintf(fp, "      \"cv_real_time_ms\": %.6f,\n", cvMs);
+        fprintf(fp, "      \"cv_ns_per_pixel\": %.4f,\n", cvMs*1e6/pixels);
+        fprintf(fp, "      \"speedup\": %.4f,\n", cvMs/ms);
+        fprintf(fp, "      \"cv_ccs_iterations\": %d,\n", cvRealIters);
+        fprintf(fp, "      \"cv_ccs_real_time_ms\": %.6f,\n", cvRealMs);
+        fprintf(fp, "      \"speedup_ccs\": %.4f,\n", cvRealMs/ms);
+        fprintf(fp, "      \"max_rel_error\": %g\n    }", relErr);
+        fflush(fp);
+        first = false;
+
+        // progress on stderr, stdout may be the JSON
+        fprintf(stderr, "%-16s %9.3f ms  x%.2f vs cv complex  x%.2f vs cv ccs  rel err %g\n", \
+            name, ms, cvMs/ms, cvRealMs/ms, relErr);
+    }
+    fprintf(fp, "\n  ]\n}\n");
+    if(out)
+        fclose(fp);
+    return 0;
+}
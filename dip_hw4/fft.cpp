@@ -0,0 +1,219 @@
+#include <cmath>
+#include <cassert>
+#include <cstring>
+#include <algorithm>
+#include <opencv2/opencv.hpp>
+#include "fft.h"
+
+using namespace std;
+using namespace cv;
+
+// side of the square tiles of the transpose, 32x32 complex floats = 8KB
+#define FFT_TILE 32
+
+bool FftPlan::build(int len) {
+    n = len;
+    radix.clear();
+    fwd.clear();
+    inv.clear();
+    int rest = len;
+    while(rest % 4 == 0) {
+        radix.push_back(4);
+        rest /= 4;
+    }
+    const int others[] = {2, 3, 5};
+    for(int k=0; k<3; k++)
+        while(rest % others[k] == 0) {
+            radix.push_back(others[k]);
+            rest /= others[k];
+        }
+    if(rest != 1 || len < 1)
+        return false;
+
+    int m = len;
+    for(size_t st=0; st<radix.size(); st++) {
+        int r = radix[st];
+        int q = m/r;
+        vector<float> f(2*m), b(2*m);
+        for(int p=0; p<q; p++)
+            for(int u=0; u<r; u++) {
+                double a = -2*CV_PI*p*u/m;
+                int i = 2*(p*r+u);
+                f[i] = b[i] = (float)cos(a);
+                f[i+1] = (float)sin(a);
+                b[i+1] = -f[i+1];
+            }
+        fwd.push_back(f);
+        inv.push_back(b);
+        m = q;
+    }
+    return true;
+}
+
+// radix-R butterfly of r inputs a[k*da], k < R, into o (interleaved);
+// sg is the sign of i, -1 forward and 1 inverse
+template<int R>
+static inline void butterfly(const float *a, int da, float sg, float *o) {
+    const float c3 = 0.5f, s3 = 0.86602540378f;
+    const float c51 = 0.30901699437f, c52 = -0.80901699437f;
+    const float s51 = 0.95105651630f, s52 = 0.58778525229f;
+    if(R == 4) {
+        float t0r = a[0]+a[2*da], t0i = a[1]+a[2*da+1];
+        float t1r = a[0]-a[2*da], t1i = a[1]-a[2*da+1];
+        float t2r = a[da]+a[3*da], t2i = a[da+1]+a[3*da+1];
+        // (a1-a3) times -i (forward) or i (inverse)
+        float t3r = -sg*(a[da+1]-a[3*da+1]), t3i = sg*(a[da]-a[3*da]);
+        o[0] = t0r+t2r; o[1] = t0i+t2i;
+        o[2] = t1r+t3r; o[3] = t1i+t3i;
+        o[4] = t0r-t2r; o[5] = t0i-t2i;
+        o[6] = t1r-t3r; o[7] = t1i-t3i;
+    }
+    else if(R == 2) {
+        o[0] = a[0]+a[da]; o[1] = a[1]+a[da+1];
+        o[2] = a[0]-a[da]; o[3] = a[1]-a[da+1];
+    }
+    else if(R == 3) {
+        float tr = a[da]+a[2*da], ti = a[da+1]+a[2*da+1];
+        float mr = a[0]-c3*tr, mi = a[1]-c3*ti;
+        float dr = -sg*s3*(a[da+1]-a[2*da+1]), di = sg*s3*(a[da]-a[2*da]);
+        o[0] = a[0]+tr; o[1] = a[1]+ti;
+        o[2] = mr+dr; o[3] = mi+di;
+        o[4] = mr-dr; o[5] = mi-di;
+    }
+    else {
+        float t1r = a[da]+a[4*da], t1i = a[da+1]+a[4*da+1];
+        float t2r = a[2*da]+a[3*da], t2i = a[2*da+1]+a[3*da+1];
+        float t3r = a[da]-a[4*da], t3i = a[da+1]-a[4*da+1];
+        float t4r = a[2*da]-a[3*da], t4i = a[2*da+1]-a[3*da+1];
+        float b1r = a[0]+c51*t1r+c52*t2r, b1i = a[1]+c51*t1i+c52*t2i;
+        float b2r = a[0]+c52*t1r+c51*t2r, b2i = a[1]+c52*t1i+c51*t2i;
+        // i*sg times (s1*t3 + s2*t4) and (s2*t3 - s1*t4)
+        float e1r = -sg*(s51*t3i+s52*t4i), e1i = sg*(s51*t3r+s52*t4r);
+        float e2r = -sg*(s52*t3i-s51*t4i), e2i = sg*(s52*t3r-s51*t4r);
+        o[0] = a[0]+t1r+t2r; o[1] = a[1]+t1i+t2i;
+        o[2] = b1r+e1r; o[3] = b1i+e1i;
+        o[4] = b2r+e2r; o[5] = b2i+e2i;
+        o[6] = b2r-e2r; o[7] = b2i-e2i;
+        o[8] = b1r-e1r; o[9] = b1i-e1i;
+    }
+}
+
+// one stage of length m and stride s: input element (j, p+k*m/R) goes
+// through the butterfly to output (j, R*p+u), times w_m^(p*u)
+template<int R>
+static void stage(const float *x, float *y, int m, int s, const float *tw, float sg) {
+    int q = m/R, da = 2*s*q, db = 2*s;
+    for(int p=0; p<q; p++) {
+        const float *w = tw + 2*p*R;
+        for(int j=0; j<s; j++) {
+            const float *a = x + 2*(j + s*p);
+            float *b = y + 2*(j + s*R*p);
+            float o[2*R];
+            butterfly<R>(a, da, sg, o);
+            b[0] = o[0];
+            b[1] = o[1];
+            for(int u=1; u<R; u++) {
+                float wr = w[2*u], wi = w[2*u+1];
+                b[u*db] = o[2*u]*wr - o[2*u+1]*wi;
+                b[u*db+1] = o[2*u]*wi + o[2*u+1]*wr;
+            }
+        }
+    }
+}
+
+void FftPlan::run(float *data, float *work, bool inverse) const {
+    float *x = data, *y = work;
+    float sg = inverse ? 1.f : -1.f;
+    int m = n, s = 1;
+    for(size_t st=0; st<radix.size(); st++) {
+        int r = radix[st];
+        const float *tw = inverse ? &inv[st][0] : &fwd[st][0];
+        switch(r) {
+        case 4: stage<4>(x, y, m, s, tw, sg); break;
+        case 2: stage<2>(x, y, m, s, tw, sg); break;
+        case 3: stage<3>(x, y, m, s, tw, sg); break;
+        default: stage<5>(x, y, m, s, tw, sg);
+        }
+        swap(x, y);
+        m /= r;
+        s *= r;
+    }
+    if(x != data)
+        memcpy(data, x, 2*n*sizeof(float));
+}
+
+// transforms rows of a CV_32FC2 image in place
+class RowFftBody : public ParallelLoopBody {
+public:
+    RowFftBody(Mat &data, const FftPlan &plan, bool inverse) :
+        data_(data), plan_(plan), inverse_(inverse) {}
+
+    void operator()(const Range &range) const {
+        vector<float> work(2*plan_.n);
+        for(int y=range.start; y<range.end; y++)
+            plan_.run(data_.ptr<float>(y), &work[0], inverse_);
+    }
+
+private:
+    Mat &data_;
+    const FftPlan &plan_;
+    bool inverse_;
+};
+
+// dst = src transposed, a band of FFT_TILE source rows per index
+class TransposeBody : public ParallelLoopBody {
+public:
+    TransposeBody(const Mat &src, Mat &dst) : src_(src), dst_(dst) {}
+
+    void operator()(const Range &range) const {
+        for(int band=range.start; band<range.end; band++) {
+            int y0 = band*FFT_TILE, y1 = min(src_.rows, y0+FFT_TILE);
+            for(int x0=0; x0<src_.cols; x0+=FFT_TILE) {
+                int x1 = min(src_.cols, x0+FFT_TILE);
+                for(int y=y0; y<y1; y++) {
+                    const uint64 *s = src_.ptr<uint64>(y);
+                    for(int x=x0; x<x1; x++)
+                        dst_.ptr<uint64>(x)[y] = s[x];
+                }
+            }
+        }
+    }
+
+private:
+    const Mat &src_;
+    Mat &dst_;
+};
+
+static void transposeTiled(const Mat &src, Mat &dst) {
+    // a complex float moves as one 64-bit word
+    dst.create(src.cols, src.rows, CV_32FC2);
+    parallel_for_(Range(0, (src.rows+FFT_TILE-1)/FFT_TILE), TransposeBody(src, dst));
+}
+
+bool Fft2D::supports(Size size) {
+    FftPlan p;
+    return p.build(size.width) && p.build(size.height);
+}
+
+void Fft2D::init(Size size) {
+    if(size == size_)
+        return;
+    size_ = size;
+    bool ok = rowPlan_.build(size.width) && colPlan_.build(size.height);
+    assert(ok);
+    (void)ok;
+}
+
+void Fft2D::forward(Mat &src, Mat &dstT) {
+    assert(src.size() == size_ && src.type() == CV_32FC2);
+    parallel_for_(Range(0, src.rows), RowFftBody(src, rowPlan_, false));
+    transposeTiled(src, dstT);
+    parallel_for_(Range(0, dstT.rows), RowFftBody(dstT, colPlan_, false));
+}
+
+void Fft2D::inverse(Mat &srcT, Mat &dst) {
+    assert(srcT.rows == size_.width && srcT.cols == size_.height && srcT.type() == CV_32FC2);
+    parallel_for_(Range(0, srcT.rows), RowFftBody(srcT, colPlan_, true));
+    transposeTiled(srcT, dst);
+    parallel_for_(Range(0, dst.rows), RowFftBody(dst, rowPlan_, true));
+}
@@ -0,0 +1,46 @@
+#ifndef FFT_H
+#define FFT_H
+
+#include <vector>
+#include <opencv2/opencv.hpp>
+
+// One 1-D transform length: the radix of each stage (4, 2, 3 or 5) and
+// its twiddle factors for both directions. run() transforms in place,
+// ping-ponging with a work buffer of the same length (self-sorting
+// Stockham stages, so no bit reversal pass).
+struct FftPlan {
+    int n;
+    std::vector<int> radix;
+    // per stage, w^(p*u) for p < n_stage/radix, u < radix
+    std::vector<std::vector<float> > fwd, inv;
+
+    FftPlan() : n(0) {}
+    // false when n has a prime factor other than 2, 3 and 5
+    bool build(int n);
+    // data and work hold n interleaved complex floats; the inverse is
+    // unscaled like dft(DFT_INVERSE)
+    void run(float *data, float *work, bool inverse) const;
+};
+
+// Parallel complex 2-D FFT of CV_32FC2 images with sides made of the
+// factors getOptimalDFTSize() uses. The rows are transformed in parallel,
+// the image is transposed in cache-sized tiles and the former columns are
+// transformed as rows. The spectrum is left transposed, which saves the
+// transpose back: filters that only scale the spectrum can work on it in
+// that layout, and inverse() takes it the same way.
+class Fft2D {
+public:
+    static bool supports(cv::Size size);
+
+    void init(cv::Size size);
+    // src (rows x cols) is overwritten; dstT gets the spectrum, cols x rows
+    void forward(cv::Mat &src, cv::Mat &dstT);
+    // back from a transposed spectrum (overwritten) to dst, rows x cols
+    void inverse(cv::Mat &srcT, cv::Mat &dst);
+
+private:
+    cv::Size size_;
+    FftPlan rowPlan_, colPlan_;
+};
+
+#endif
@@ -0,0 +1,285 @@
+#include <cmath>
+#include <cassert>
+#include <vector>
+#include <opencv2/opencv.hpp>
+#include "freqfilter.h"
+
+using namespace std;
+using namespace cv;
+
+// cost model of FILTER_METHOD_AUTO, in float operations per pixel:
+// forward and inverse real DFT per log2 of the padded pixel count, and
+// one multiply-add per tap of each separable pass
+#define FFT_COST_PER_LOG2 5.0
+#define SPATIAL_COST_PER_TAP 2.0
+
+static int centerOffset(int i, int n) {
+    // signed frequency of sample i of the corner-origin layout
+    return i < n-n/2 ? i : i-n;
+}
+
+static inline float filteredMagnitude(float a, float b, float h) {
+    // |(a+ib)*h|, rounded the way multiply() and magnitude() do
+    float re = a*h, im = b*h;
+    return sqrt(re*re+im*im);
+}
+
+FreqFilter::FreqFilter() : type_(-1), d0_(0), path_(DFT_PATH_REAL), fftImpl_(FFT_IMPL_OPENCV),
+    method_(FILTER_METHOD_FFT), order_(2), spatial_(false), keepSpectrum_(false) {}
+
+void FreqFilter::setPath(int path) {
+    path_ = path;
+    type_ = -1;
+}
+
+void FreqFilter::setFft(int impl) {
+    fftImpl_ = impl;
+    type_ = -1;
+}
+
+void FreqFilter::setMethod(int method) {
+    method_ = method;
+    type_ = -1;
+}
+
+void FreqFilter::setOrder(int order) {
+    order_ = order;
+    type_ = -1;
+}
+
+void FreqFilter::init(Size size, int type, float d0) {
+    if(size == size_ && type == type_ && d0 == d0_)
+        return;
+
+    padded_ = Size(getOptimalDFTSize(size.width), getOptimalDFTSize(size.height));
+    size_ = size;
+    type_ = type;
+    d0_ = d0;
+
+    mask_.create(padded_, CV_32F);
+    buildMask();
+
+    // the Gaussian is also a separable Gaussian in space, with
+    // sigma = N/(2*pi*D0) along an axis of N padded samples
+    sigmaX_ = padded_.width/(2*CV_PI*d0_);
+    sigmaY_ = padded_.height/(2*CV_PI*d0_);
+    kx_ = 2*cvCeil(3*sigmaX_)+1;
+    ky_ = 2*cvCeil(3*sigmaY_)+1;
+    bool gaussian = type_ == FILTER_GHPF || type_ == FILTER_GLPF;
+    spatial_ = gaussian && method_ == FILTER_METHOD_SPATIAL;
+    if(gaussian && method_ == FILTER_METHOD_AUTO) {
+        double fftCost = FFT_COST_PER_LOG2*log((double)padded_.area())/log(2.);
+        double spatialCost = SPATIAL_COST_PER_TAP*(kx_+ky_);
+        spatial_ = spatialCost < fftCost;
+    }
+    if(spatial_) {
+        real_ = kernel_ = complex_ = spec_ = trans_ = Mat();
+        work_.create(size_, CV_32F);
+        blur_.create(size_, CV_32F);
+        return;
+    }
+    work_ = blur_ = Mat();
+
+    real_.create(padded_, CV_32F);
+    if(realPath()) {
+        complex_ = trans_ = Mat();
+        packKernel();
+        return;
+    }
+    complex_.create(padded_, CV_32FC2);
+    // the mask scales real and imaginary part alike
+    Mat planes[] = {mask_, mask_};
+    if(fftImpl_ == FFT_IMPL_BUILTIN) {
+        fft_.init(padded_);
+        trans_.create(padded_.width, padded_.height, CV_32FC2);
+        spec_ = Mat();
+        Mat maskT;
+        transpose(mask_, maskT);
+        planes[0] = planes[1] = maskT;
+    }
+    else {
+        trans_ = Mat();
+        spec_ = complex_;
+    }
+    merge(planes, 2, kernel_);
+}
+
+void FreqFilter::buildMask() {
+    // squared frequency along each axis, laid out from the corner like the
+    // spectrum; a Gaussian exp(-(px^2+py^2)/(2*D0^2)) is then the outer
+    // product of two 1-D tables
+    bool gaussian = type_ == FILTER_GHPF || type_ == FILTER_GLPF;
+    vector<double> tx(padded_.width), ty(padded_.height);
+    double a = -1/(2.*d0_*d0_);
+    for(int i=0; i<padded_.width; i++) {
+        double px = centerOffset(i, padded_.width);
+        tx[i] = gaussian ? exp(a*px*px) : px*px;
+    }
+    for(int j=0; j<padded_.height; j++) {
+        double py = centerOffset(j, padded_.height);
+        ty[j] = gaussian ? exp(a*py*py) : py*py;
+    }
+
+    double d02 = (double)d0_*d0_;
+    for(int j=0; j<padded_.height; j++) {
+        float *m = mask_.ptr<float>(j);
+        switch(type_) {
+        case FILTER_GHPF:
+            for(int i=0; i<padded_.width; i++)
+                m[i] = (float)(1-ty[j]*tx[i]);
+            break;
+        case FILTER_GLPF:
+            for(int i=0; i<padded_.width; i++)
+                m[i] = (float)(ty[j]*tx[i]);
+            break;
+        case FILTER_BHPF:
+            for(int i=0; i<padded_.width; i++) {
+                double d2 = ty[j]+tx[i];
+                m[i] = d2 > 0 ? (float)(1/(1+pow(d02/d2, order_))) : 0.f;
+            }
+            break;
+        case FILTER_BLPF:
+            for(int i=0; i<padded_.width; i++)
+                m[i] = (float)(1/(1+pow((ty[j]+tx[i])/d02, order_)));
+            break;
+        case FILTER_IHPF:
+            for(int i=0; i<padded_.width; i++)
+                m[i] = ty[j]+tx[i] > d02 ? 1.f : 0.f;
+            break;
+        default:
+            for(int i=0; i<padded_.width; i++)
+                m[i] = ty[j]+tx[i] <= d02 ? 1.f : 0.f;
+        }
+    }
+}
+
+void FreqFilter::packKernel() {
+    // The mask is real and even, so filtering scales both parts of every
+    // packed entry by the mask value at its frequency; kernel_ holds those
+    // factors in the CCS layout.
+    int M = padded_.height, N = padded_.width;
+    kernel_.create(padded_, CV_32F);
+    for(int i=0; i<M; i++) {
+        const float *m = mask_.ptr<float>(i);
+        float *k = kernel_.ptr<float>(i);
+        for(int j=1; j<=(N-1)/2; j++)
+            k[2*j-1] = k[2*j] = m[j];
+    }
+
+    int ncols = N > 1 && N % 2 == 0 ? 2 : 1;
+    for(int s=0; s<ncols; s++) {
+        int c = s ? N/2 : 0, kc = s ? N-1 : 0;
+        kernel_.at<float>(0, kc) = mask_.at<float>(0, c);
+        for(int u=1; u<=(M-1)/2; u++)
+            kernel_.at<float>(2*u-1, kc) = kernel_.at<float>(2*u, kc) = mask_.at<float>(u, c);
+        if(M > 1 && M % 2 == 0)
+            kernel_.at<float>(M-1, kc) = mask_.at<float>(M/2, c);
+    }
+}
+
+void FreqFilter::unpackSpectrum() {
+    // magnitude of the filtered full spectrum from the CCS of the image,
+    // the other half being the complex conjugate
+    int M = padded_.height, N = padded_.width;
+    spec_.create(padded_, CV_32F);
+    for(int i=0; i<M; i++) {
+        const float *r = real_.ptr<float>(i);
+        int i2 = (M-i) % M;
+        for(int j=1; j<=(N-1)/2; j++) {
+            spec_.at<float>(i, j) = filteredMagnitude(r[2*j-1], r[2*j], mask_.at<float>(i, j));
+            spec_.at<float>(i2, N-j) = filteredMagnitude(r[2*j-1], -r[2*j], mask_.at<float>(i2, N-j));
+        }
+    }
+
+    int ncols = N > 1 && N % 2 == 0 ? 2 : 1;
+    for(int s=0; s<ncols; s++) {
+        int c = s ? N/2 : 0, kc = s ? N-1 : 0;
+        spec_.at<float>(0, c) = filteredMagnitude(real_.at<float>(0, kc), 0, mask_.at<float>(0, c));
+        for(int u=1; u<=(M-1)/2; u++) {
+            float a = real_.at<float>(2*u-1, kc), b = real_.at<float>(2*u, kc);
+            spec_.at<float>(u, c) = filteredMagnitude(a, b, mask_.at<float>(u, c));
+            spec_.at<float>(M-u, c) = filteredMagnitude(a, -b, mask_.at<float>(M-u, c));
+        }
+        if(M > 1 && M % 2 == 0)
+            spec_.at<float>(M/2, c) = filteredMagnitude(real_.at<float>(M-1, kc), 0, mask_.at<float>(M/2, c));
+    }
+}
+
+void FreqFilter::apply(const Mat &src, Mat &dst) {
+    assert(src.size() == size_ && src.type() == CV_8U);
+
+    if(spatial_) {
+        // lowpass is the blur, highpass what the blur takes away
+        src.convertTo(work_, CV_32F);
+        GaussianBlur(work_, blur_, Size(kx_, ky_), sigmaX_, sigmaY_, BORDER_REFLECT_101);
+        if(type_ == FILTER_GHPF)
+            subtract(work_, blur_, blur_);
+        normalize(blur_, blur_, 0, 1, NORM_MINMAX);
+        blur_.convertTo(dst, CV_8U, 255.0);
+        return;
+    }
+
+    if(realPath()) {
+        // source and zero padding, transformed in place; the padding rows
+        // need no row transforms and only the source rows are needed back
+        for(int j=0; j<padded_.height; j++) {
+            float *p = real_.ptr<float>(j);
+            int i = 0;
+            if(j < size_.height) {
+                const uchar *s = src.ptr(j);
+                for(; i<size_.width; i++)
+                    p[i] = s[i];
+            }
+            for(; i<padded_.width; i++)
+                p[i] = 0;
+        }
+
+        dft(real_, real_, 0, size_.height);
+        if(keepSpectrum_)
+            unpackSpectrum();
+        multiply(real_, kernel_, real_);
+        dft(real_, real_, DFT_INVERSE | DFT_REAL_OUTPUT, size_.height);
+    }
+    else {
+        // source as real part, zero imaginary part and zero padding
+        for(int j=0; j<padded_.height; j++) {
+            float *p = complex_.ptr<float>(j);
+            int i = 0;
+            if(j < size_.height) {
+                const uchar *s = src.ptr(j);
+                for(; i<size_.width; i++) {
+                    p[2*i] = s[i];
+                    p[2*i+1] = 0;
+                }
+            }
+            for(; i<padded_.width; i++)
+                p[2*i] = p[2*i+1] = 0;
+        }
+
+        if(fftImpl_ == FFT_IMPL_OPENCV) {
+            dft(complex_, complex_);
+            multiply(complex_, kernel_, complex_);
+            idft(complex_, real_, DFT_REAL_OUTPUT);
+        }
+        else {
+            fft_.forward(complex_, trans_);
+            multiply(trans_, kernel_, trans_);
+            if(keepSpectrum_)
+                transpose(trans_, spec_);
+            fft_.inverse(trans_, complex_);
+            // the spectrum is conjugate symmetric, so the imaginary part is
+            // rounding noise; only the rows covering the source are needed
+            for(int j=0; j<size_.height; j++) {
+                const float *c = complex_.ptr<float>(j);
+                float *r = real_.ptr<float>(j);
+                for(int i=0; i<size_.width; i++)
+                    r[i] = c[2*i];
+            }
+        }
+    }
+
+    // scale the part covering the source to 0-255
+    Mat roi = real_(Rect(0, 0, size_.width, size_.height));
+    normalize(roi, roi, 0, 1, NORM_MINMAX);
+    roi.convertTo(dst, CV_8U, 255.0);
+}
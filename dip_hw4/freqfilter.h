@@ -0,0 +1,114 @@
+#ifndef FREQFILTER_H
+#define FREQFILTER_H
+
+#include <opencv2/opencv.hpp>
+#include "fft.h"
+
+// filter types, same values as the options asked for at runtime
+enum FilterType {
+    FILTER_GHPF = 0,    // Gaussian highpass
+    FILTER_GLPF = 1,    // Gaussian lowpass
+    FILTER_BHPF = 2,    // Butterworth highpass
+    FILTER_BLPF = 3,    // Butterworth lowpass
+    FILTER_IHPF = 4,    // ideal highpass
+    FILTER_ILPF = 5     // ideal lowpass
+};
+
+// how the spectrum is computed and stored
+enum DftPath {
+    DFT_PATH_REAL = 0,      // real input, packed half spectrum (CCS)
+    DFT_PATH_COMPLEX = 1    // zero imaginary part, full complex spectrum
+};
+
+// which FFT computes the spectrum
+enum FftImpl {
+    FFT_IMPL_OPENCV = 0,    // dft()/idft()
+    FFT_IMPL_BUILTIN = 1    // Fft2D, parallel rows and tiled transpose
+};
+
+// where the filter is applied
+enum FilterMethod {
+    FILTER_METHOD_FFT = 0,      // multiply in the frequency domain
+    FILTER_METHOD_SPATIAL = 1,  // separable Gaussian convolution
+    FILTER_METHOD_AUTO = 2      // whichever is estimated cheaper
+};
+
+// Frequency-domain filtering engine for 8-bit images of one size.
+// init() works out the padded DFT size, allocates the spectrum buffers and
+// builds the filter spectrum, already shifted to the corner-origin layout
+// of dft(); all of it is kept until size, filter type or D0 change. apply()
+// then only runs the forward DFT, the spectrum multiply and the inverse
+// DFT, so a sequence of same-sized frames allocates nothing after the
+// first one.
+// The real path keeps only the non-redundant half of the conjugate
+// symmetric spectrum of the real image, in place in one float buffer, and
+// scales that half by the filter; it gives the same output as the complex
+// path in about half the time and memory.
+// The spatial method is for the Gaussian filters only, the others always
+// run through the DFT. It convolves with the Gaussian that the frequency mask is
+// the transform of, sigma = N/(2*pi*D0) per axis; for large D0 that kernel
+// is small and cheaper than the two DFTs. It matches the frequency output
+// up to the borders (reflected instead of zero-padded and periodic).
+// The built-in FFT runs the complex path on all cores whatever OpenCV was
+// built with. It keeps the spectrum transposed, so the filter is stored
+// transposed too and only spectrum() transposes back.
+class FreqFilter {
+public:
+    FreqFilter();
+
+    void init(cv::Size size, int type, float d0);
+    // src must have the size given to init(); dst gets the filtered image
+    // scaled to 0-255 like the original doIDFT()
+    void apply(const cv::Mat &src, cv::Mat &dst);
+
+    // init() has to be called again after changing it
+    void setPath(int path);
+    int path() const { return path_; }
+    // OpenCV or built-in FFT; the built-in one always takes the complex
+    // path. init() has to be called again after changing it
+    void setFft(int impl);
+    // FFT, spatial or auto; init() has to be called again after changing it
+    void setMethod(int method);
+    // order n of the Butterworth filters, 1/(1+(D/D0)^2n); 2 by default
+    void setOrder(int order);
+    // true when init() settled on the spatial convolution
+    bool spatial() const { return spatial_; }
+    // keep the filtered spectrum for spectrum(); an extra pass on the real
+    // path, which otherwise never has the full spectrum
+    void setKeepSpectrum(bool keep) { keepSpectrum_ = keep; }
+
+    // filter in corner-origin layout (CV_32F, padded size)
+    const cv::Mat &mask() const { return mask_; }
+    // filtered spectrum of the last apply(), padded size: CV_32FC2 on the
+    // complex path, its magnitude (CV_32F) on the real path, empty when
+    // the filter ran in space
+    const cv::Mat &spectrum() const { return spec_; }
+
+private:
+    bool realPath() const { return path_ == DFT_PATH_REAL && fftImpl_ == FFT_IMPL_OPENCV; }
+    void buildMask();
+    void packKernel();
+    void unpackSpectrum();
+
+    cv::Size size_, padded_;
+    int type_;
+    float d0_;
+    int path_;
+    int fftImpl_;
+    int method_;
+    int order_;
+    bool spatial_;
+    bool keepSpectrum_;
+    double sigmaX_, sigmaY_;
+    int kx_, ky_;
+    cv::Mat mask_;
+    cv::Mat kernel_;    // mask per spectrum value: (mask, mask) or in CCS layout
+    cv::Mat complex_;   // complex path spectrum
+    cv::Mat real_;      // real path spectrum (CCS), inverse DFT on both paths
+    cv::Mat spec_;      // spectrum(): complex_, the magnitude or transposed back
+    cv::Mat trans_;     // built-in FFT spectrum, transposed
+    Fft2D fft_;
+    cv::Mat work_, blur_;   // spatial method, source size
+};
+
+#endif
@@ -1,134 +1,177 @@
 #include <iostream>
+#include <fstream>
 #include <string>
+#include <vector>
+#include <thread>
 #include <cstdio>
+#include <cstdlib>
+#include <cstring>
 #include <cassert>
 
 #include <opencv2/opencv.hpp>
+#include "freqfilter.h"
 
 using namespace std;
 using namespace cv;
 
-Mat doDFT(Mat img);
-Mat doIDFT(Mat imgComplex);
 Mat makeSpecImg(Mat imgComplex);
 void shift(Mat &specImg);
 
-void createGHPF(Mat &mask, float d0);
-void createGLPF(Mat &mask, float d0);
-
 string type2str(int type);
 
-int main(int argc, char ** argv)
-{
-    const char* filename = argc >=2 ? argv[1] : "selfie.jpg";
-    Mat img = imread(filename, 0);
-    if(img.empty())
-        return -1;
-   
-    int opt;
-    printf("Choose options from below:\n  [0] GHPF\n  [1] GLPF\n");
-    scanf("%d", &opt);
+// command line names, in FilterType order
+const char *filterNames[] = {"ghpf", "glpf", "bhpf", "blpf", "ihpf", "ilpf"};
+const int nFilters = sizeof(filterNames)/sizeof(filterNames[0]);
 
-switch(opt) {
-case 0:
-{
-    Mat imgComplex = doDFT(img);
-    Mat specImg = makeSpecImg(imgComplex);
-
-    // create Gaussian highpass filter
-    int d0;
-    printf("GHPF: D0 = ");
-    scanf("%d", &d0);
-    Mat GHPF = Mat::zeros(img.size(), CV_32F);
-    createGHPF(GHPF, d0);
-    shift(GHPF);
-    
-    // multiply with Gaussian filter in freq. domain
-    Mat planes[] = {Mat::zeros(GHPF.size(), CV_32F), Mat::zeros(GHPF.size(), CV_32F)};
-    Mat kernel_spec;
-    planes[0] = GHPF; // real
-    planes[1] = GHPF; // imaginary
-    merge(planes, 2, kernel_spec);
- 
-    mulSpectrums(imgComplex, kernel_spec, imgComplex, DFT_ROWS); // only DFT_ROWS accepted
-    specImg = makeSpecImg(GHPF);
-    imwrite("filter.jpg", specImg);
-    specImg = makeSpecImg(imgComplex);
-    imwrite("spectrum.jpg", specImg);
-    
-    // perform inverse fourier transform
-    Mat dstImg = doIDFT(imgComplex);
-    imwrite("output.jpg", dstImg);
-    break;
-}
-case 1:
-{
-    Mat imgComplex = doDFT(img);
-    Mat specImg = makeSpecImg(imgComplex);
-
-    // create Gaussian highpass filter
-    int d0;
-    printf("GLPF: D0 = ");
-    scanf("%d", &d0);
-    Mat GLPF = Mat::zeros(img.size(), CV_32F);
-    createGLPF(GLPF, d0);
-    shift(GLPF);
-    
-    // multiply with Gaussian filter in freq. domain
-    Mat planes[] = {Mat::zeros(GLPF.size(), CV_32F), Mat::zeros(GLPF.size(), CV_32F)};
-    Mat kernel_spec;
-    planes[0] = GLPF; // real
-    planes[1] = GLPF; // imaginary
-    merge(planes, 2, kernel_spec);
- 
-    mulSpectrums(imgComplex, kernel_spec, imgComplex, DFT_ROWS); // only DFT_ROWS accepted
-    specImg = makeSpecImg(GLPF);
-    imwrite("filter.jpg", specImg);
-    specImg = makeSpecImg(imgComplex);
-    imwrite("spectrum.jpg", specImg);
-    
-    // perform inverse fourier transform
-    Mat dstImg = doIDFT(imgComplex);
-    imwrite("output.jpg", dstImg);
-    break;
-}
-default:
-{
-    fprintf(stderr, "bad parameter\n");
-    return -1;
+void usage() {
+    printf("usage: main [<image file path>] [--filter <f>] [--d0 <D0>] [--order <n>]\n");
+    printf("            [--method fft|spatial|auto] [--path real|complex] [--vis|--no-vis]\n");
+    printf("            [--fft opencv|builtin] [--batch <list file>]\n");
+    printf("<f>: ghpf, glpf, bhpf, blpf, ihpf, ilpf (Gaussian, Butterworth, ideal high/lowpass)\n");
+    printf("filter and D0 are asked for at runtime when not given\n");
 }
 
-}
-    
-    return 0;
+string fileStem(const string &path) {
+    size_t slash = path.find_last_of("/\\");
+    string name = slash == string::npos ? path : path.substr(slash+1);
+    size_t dot = name.rfind('.');
+    return dot == string::npos ? name : name.substr(0, dot);
 }
 
-Mat doDFT(Mat img) {
-    // expand input image to optimal size
-    Mat padded;                            
-    int m = getOptimalDFTSize(img.rows);
-    int n = getOptimalDFTSize(img.cols);
-    
-    // expand border with zeros
-    copyMakeBorder(img, padded, 0, m-img.rows, 0, n-img.cols, BORDER_CONSTANT, Scalar::all(0));
-    Mat planes[] = {Mat_<float>(padded), Mat::zeros(padded.size(), CV_32F)};
-    
-    Mat complex;
-    merge(planes, 2, complex);
-    dft(complex, complex);
-    
-    return complex;
-}
+bool filterImage(FreqFilter &filter, const Mat &img, int type, float d0, bool vis, const string &prefix) {
+    filter.setKeepSpectrum(vis);
+    filter.init(img.size(), type, d0);
 
-Mat doIDFT(Mat imgComplex) {
+    // multiply with the filter in freq. domain and transform back
     Mat dstImg;
-    
-    idft(imgComplex, dstImg, DFT_REAL_OUTPUT);
-    
-    normalize(dstImg, dstImg, 0, 1, CV_MINMAX);
-    dstImg.convertTo(dstImg, CV_8U, 255.0);
-    
-    return dstImg;
+    filter.apply(img, dstImg);
+    if(vis) {
+        imwrite(prefix + "filter.jpg", makeSpecImg(filter.mask()));
+        if(!filter.spatial())
+            imwrite(prefix + "spectrum.jpg", makeSpecImg(filter.spectrum()));
+    }
+    return imwrite(prefix + "output.jpg", dstImg);
+}
+
+int main(int argc, char ** argv)
+{
+    const char* filename = "selfie.jpg";
+    const char* batch = 0;
+    int type = -1, order = 2, vis = -1;
+    int method = FILTER_METHOD_FFT, path = DFT_PATH_REAL, fft = FFT_IMPL_OPENCV;
+    float d0 = -1;
+    for(int a=1; a<argc; a++) {
+        string opt = argv[a], val = a+1<argc ? argv[a+1] : "";
+        if(opt[0] != '-') {
+            filename = argv[a];
+            continue;
+        }
+        if(opt == "--vis" || opt == "--no-vis") {
+            vis = opt == "--vis";
+            continue;
+        }
+        if(a+1 >= argc) {
+            usage();
+            return -1;
+        }
+        a++;
+        if(opt == "--filter") {
+            for(int f=0; f<nFilters; f++)
+                if(val == filterNames[f])
+                    type = f;
+            if(type < 0) {
+                usage();
+                return -1;
+            }
+        }
+        else if(opt == "--d0")
+            d0 = atof(val.c_str());
+        else if(opt == "--order")
+            order = atoi(val.c_str());
+        else if(opt == "--method" && (val == "fft" || val == "spatial" || val == "auto"))
+            method = val == "fft" ? FILTER_METHOD_FFT : val == "spatial" ? FILTER_METHOD_SPATIAL : FILTER_METHOD_AUTO;
+        else if(opt == "--path" && (val == "real" || val == "complex"))
+            path = val == "real" ? DFT_PATH_REAL : DFT_PATH_COMPLEX;
+        else if(opt == "--fft" && (val == "opencv" || val == "builtin"))
+            fft = val == "opencv" ? FFT_IMPL_OPENCV : FFT_IMPL_BUILTIN;
+        else if(opt == "--batch")
+            batch = argv[a];
+        else {
+            usage();
+            return -1;
+        }
+    }
+
+    if(type < 0) {
+        printf("Choose options from below:\n  [0] GHPF\n  [1] GLPF\n  [2] BHPF\n  [3] BLPF\n  [4] IHPF\n  [5] ILPF\n");
+        if(scanf("%d", &type) != 1 || type < 0 || type >= nFilters) {
+            fprintf(stderr, "bad parameter\n");
+            return -1;
+        }
+    }
+    if(d0 < 0) {
+        int d;
+        printf("%c%cPF: D0 = ", toupper(filterNames[type][0]), toupper(filterNames[type][1]));
+        if(scanf("%d", &d) != 1)
+            d = 0;
+        d0 = d;
+    }
+    if(d0 <= 0 || order < 1) {
+        fprintf(stderr, "bad parameter\n");
+        return -1;
+    }
+
+    FreqFilter filter;
+    filter.setMethod(method);
+    filter.setPath(path);
+    filter.setFft(fft);
+    filter.setOrder(order);
+
+    if(!batch) {
+        Mat img = imread(filename, 0);
+        if(img.empty())
+            return -1;
+        return filterImage(filter, img, type, d0, vis != 0, "") ? 0 : -1;
+    }
+
+    // one image path per line, outputs are <name>_output.jpg and so on
+    vector<string> inputs;
+    ifstream list(batch);
+    string line;
+    while(getline(list, line)) {
+        size_t e = line.find_last_not_of(" \t\r");
+        if(e != string::npos && line[0] != '#')
+            inputs.push_back(line.substr(0, e+1));
+    }
+    if(inputs.empty()) {
+        printf("No images in %s.\n", batch);
+        return -1;
+    }
+
+    // the filter stays set up while the size does not change, and the next
+    // image is decoded while the current one is filtered
+    int failed = 0;
+    double t0 = (double)getTickCount();
+    Mat img = imread(inputs[0], 0), next;
+    for(size_t i=0; i<inputs.size(); i++) {
+        thread loader;
+        if(i+1 < inputs.size())
+            loader = thread([&] { next = imread(inputs[i+1], 0); });
+        if(img.empty()) {
+            printf("%s: cannot read, skipped.\n", inputs[i].c_str());
+            failed++;
+        }
+        else if(!filterImage(filter, img, type, d0, vis > 0, fileStem(inputs[i]) + "_")) {
+            printf("%s: cannot write, skipped.\n", inputs[i].c_str());
+            failed++;
+        }
+        if(loader.joinable())
+            loader.join();
+        swap(img, next);
+    }
+    double ms = ((double)getTickCount()-t0)*1000.0/getTickFrequency();
+    printf("%d images in %.1f ms, %d failed\n", (int)inputs.size()-failed, ms, failed);
+    return failed ? -1 : 0;
 }
 
 Mat makeSpecImg(Mat imgComplex) {
@@ -172,41 +215,6 @@ void shift(Mat &specImg) {
     
 }
 
-void createGHPF(Mat &mask, float d0) {
-    // center position
-    int cx = mask.cols/2;
-    int cy = mask.rows/2;
-    for(int i=0; i<mask.cols; i++)
-        for(int j=0; j<mask.rows; j++) {
-            float px = i-cx+1;
-            float py = j-cy+1;
-            
-            float d = sqrt(px*px+py*py);
-            
-            float fxy0 = exp(-pow(d,2)/(2*pow(d0,2)));
-            float fxy = 1-fxy0;
-            
-            mask.at<float>(Point(i,j)) = fxy;
-        }
-
-}
-void createGLPF(Mat &mask, float d0) {
-    // center position
-    int cx = mask.cols/2;
-    int cy = mask.rows/2;
-    for(int i=0; i<mask.cols; i++)
-        for(int j=0; j<mask.rows; j++) {
-            float px = i-cx+1;
-            float py = j-cy+1;
-            
-            float d = sqrt(px*px+py*py);
-            
-            float fxy = exp(-pow(d,2)/(2*pow(d0,2)));
-            mask.at<float>(Point(i,j)) = fxy;
-        }
-
-}
-
 string type2str(int type) {
     // check the type of Mat
     string r;
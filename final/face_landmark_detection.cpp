@@ -5,21 +5,32 @@
 
 #include <dlib/opencv.h>  
 #include <opencv2/opencv.hpp>  
+#include "morph.h"
 
 #include <dlib/image_processing/frontal_face_detector.h>  
 #include <dlib/image_processing/render_face_detections.h>  
 #include <dlib/image_processing.h>  
-#include <dlib/gui_widgets.h>
 
 #include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
 #include <vector>
+#include <array>
+#include <algorithm>
+#include <exception>
 #include <iomanip>
 #include <cassert>
+#include <cstdio>
+#include <cstring>
 
 using namespace std;
 using namespace dlib;
 using namespace cv;
 
+// landmark model, looked up in the working directory unless --model is given
+#define DEFAULT_MODEL "shape_predictor_68_face_landmarks.dat"
+
 void help() {
     fprintf(stderr, "Face Landmark Detection and Morphing implementation with opencv2 and dlib.\n");
     fprintf(stderr, "Source: www.learnopencv.com/face-morph-using-opencv-cpp-python\n");
@@ -31,303 +42,537 @@ static void drawpoint(Mat& img, Point2f fp, Scalar color)
     circle(img, fp, 1, color, CV_FILLED, CV_AA, 0);
 }
 
-// Apply affine transform calculated using srcTri and dstTri to src
-void applyAffineTransform(Mat &warpImage, Mat &src, std::vector<Point2f> &srcTri, std::vector<Point2f> &dstTri)
+// Per-stage wall time of one morph, in ms
+struct StageTimes {
+    double detect, landmark, triangulate, warp;
+    StageTimes() : detect(0), landmark(0), triangulate(0), warp(0) {}
+};
+
+static double msSince(double t0)
 {
-    // Given a pair of triangles, find the affine transform.
-    Mat warpMat = getAffineTransform( srcTri, dstTri );
-    // Apply the Affine Transform just found to the src image
-    warpAffine( src, warpImage, warpMat, warpImage.size(), INTER_LINEAR, BORDER_REFLECT_101);
+    return ((double)getTickCount() - t0) * 1000.0 / getTickFrequency();
 }
 
-// Warps and alpha blends triangular regions from img1 and img2 to img
-void morphTriangle(Mat &img1, Mat &img2, Mat &img, std::vector<Point2f> &t1, std::vector<Point2f> &t2, std::vector<Point2f> &t, double alpha)
+// Face detector and landmark model, loaded once per process
+struct FaceModels {
+    frontal_face_detector detector;
+    shape_predictor pose_model;
+};
+
+bool loadModels(FaceModels &models, const char *path)
 {
-    // Find bounding rectangle for each triangle
-    Rect r = boundingRect(t);
-    Rect r1 = boundingRect(t1);
-    Rect r2 = boundingRect(t2);
-    
-    // Offset points by left top corner of the respective rectangles
-    std::vector<Point2f> t1Rect, t2Rect, tRect;
-    std::vector<Point> tRectInt;
-    for(int i = 0; i < 3; i++)
-    {
-        tRect.push_back( Point2f( t[i].x - r.x, t[i].y -  r.y) );
-        tRectInt.push_back( Point(t[i].x - r.x, t[i].y - r.y) ); // for fillConvexPoly
-        
-        t1Rect.push_back( Point2f( t1[i].x - r1.x, t1[i].y -  r1.y) );
-        t2Rect.push_back( Point2f( t2[i].x - r2.x, t2[i].y - r2.y) );
+    models.detector = get_frontal_face_detector();
+    try {
+        deserialize(path) >> models.pose_model;
     }
-
-    // Get mask by filling triangle
-    Mat mask = Mat::zeros(r.height, r.width, CV_32FC3);
-    fillConvexPoly(mask, tRectInt, Scalar(1.0, 1.0, 1.0), 16, 0);
-    // Apply warpImage to small rectangular patches
-    Mat img1Rect, img2Rect;
-    
-    img1(r1).copyTo(img1Rect);
-    img2(r2).copyTo(img2Rect);
-    
-    Mat warpImage1 = Mat::zeros(r.height, r.width, img1Rect.type());
-    Mat warpImage2 = Mat::zeros(r.height, r.width, img2Rect.type());
-    
-    applyAffineTransform(warpImage1, img1Rect, t1Rect, tRect);
-    applyAffineTransform(warpImage2, img2Rect, t2Rect, tRect);
-    
-    // Alpha blend rectangular patches
-    Mat imgRect = (1.0 - alpha) * warpImage1 + alpha * warpImage2;
-    // Copy triangular region of the rectangular patch to the output image
-    
-    multiply(imgRect, mask, imgRect);
-    multiply(img(r), Scalar(1.0,1.0,1.0) - mask, img(r));
-    img(r) = img(r) + imgRect;
-    
-    
+    catch(serialization_error &e) {
+        fprintf(stderr, "Cannot load %s: %s\n", path, e.what());
+        return false;
+    }
+    return true;
 }
 
-int main(int argc, char **argv) {
-    help();
-    
-    // Usage
-    if(argc != 4) {
-        fprintf(stderr, "Invalid argument.\n");
-        fprintf(stderr, "Usage: ./face_landmark_detection <img1_path> <img2_path> <alpha>\n");
-        return -1;
-    }
-    
-    //----- Face Landmark Detection -----//
-    // Load face detection and pose estimation models 
-    // TODO: bottleneck -- some configuration need
-    frontal_face_detector detector = get_frontal_face_detector();  
-    shape_predictor pose_model;  
-    deserialize("shape_predictor_68_face_landmarks.dat") >> pose_model;  
+// 68 landmarks of the first face found in img plus 8 border points,
+// or nothing when there is no face
+std::vector<Point2f> findLandmarks(FaceModels &models, Mat &img, StageTimes &times)
+{
+    cv_image<bgr_pixel> cimg(img);
+    std::vector<Point2f> points;
 
-    Mat img1, img2;
-    img1 = imread(argv[1], 1);        
-    img2 = imread(argv[2], 1);
-    resize(img1, img1, img2.size());
-    
-    // copies of original images
-    Mat img1_orig = img1.clone();
-    Mat img2_orig = img2.clone();
-            
-    cv_image<bgr_pixel> cimg1(img1);
-    cv_image<bgr_pixel> cimg2(img2);
-    
-    // Detect faces in images
+    // Detect faces in the image
     // Actually only one face is to be used
-    std::vector<dlib::rectangle> faces1 = detector(cimg1);  
-    std::vector<dlib::rectangle> faces2 = detector(cimg2); 
-    
-    // Find the pose of each face
-    std::vector<full_object_detection> shapes1; 
-    std::vector<full_object_detection> shapes2; 
-    for(unsigned long i = 0; i < faces1.size(); ++i)  
-        shapes1.push_back(pose_model(cimg1, faces1[i]));  
-    for(unsigned long i = 0; i < faces2.size(); ++i)  
-        shapes2.push_back(pose_model(cimg2, faces2[i])); 
-    
-    // Draw feature points on images
-    if(!shapes1.empty()) for(int i = 0; i < 68; i++) {
-        drawpoint(img1, Point(shapes1[0].part(i).x(), 
-            shapes1[0].part(i).y()), cv::Scalar(0, 0, 255)); 
-    }  
-
-    if(!shapes2.empty()) for(int i = 0; i < 68; i++) {
-        drawpoint(img2, Point(shapes2[0].part(i).x(), 
-            shapes2[0].part(i).y()), cv::Scalar(0, 0, 255)); 
-    }  
+    double t0 = (double)getTickCount();
+    std::vector<dlib::rectangle> faces = models.detector(cimg);
+    times.detect += msSince(t0);
+    if(faces.empty())
+        return points;
 
-    namedWindow("Face1", WINDOW_AUTOSIZE);
-    namedWindow("Face2", WINDOW_AUTOSIZE);
-    imshow("Face1", img1);
-    imshow("Face2", img2);
-    waitKey(0);
+    // Find the pose of the face
+    t0 = (double)getTickCount();
+    full_object_detection shape = models.pose_model(cimg, faces[0]);
+    times.landmark += msSince(t0);
 
-    //----- Delaunay Triangulation -----//
-    // Reset images
-    img1 = img1_orig.clone();
-    img2 = img2_orig.clone();
-    
-    // Set region of calculation of img1
-    Size size1 = img1.size();
-    Rect rect1(0, 0, size1.width, size1.height);
-    Subdiv2D subdiv1(rect1);
-    std::vector<Point2f> points1;
-    
-    if(!shapes1.empty()) {
-        // Add 68 facial feature points
-        for(int i = 0; i < 68; i++) 
-            points1.push_back(Point(shapes1[0].part(i).x(), shapes1[0].part(i).y()));
-        
-        // Add 8 border points
-        points1.push_back(Point(0,0));
-        points1.push_back(Point(size1.width/2,0));
-        points1.push_back(Point(size1.width-1,0));
-        points1.push_back(Point(0,size1.height/2));
-        points1.push_back(Point(size1.width/2,size1.height/2));
-        points1.push_back(Point(0,size1.height-1));
-        points1.push_back(Point(size1.width/2,size1.height-1));
-        points1.push_back(Point(size1.width-1,size1.height-1));
+    // Add 68 facial feature points; faces at the image edge can have
+    // points outside, which Subdiv2D rejects, so clamp them to the image
+    Size size = img.size();
+    for(int i = 0; i < 68; i++) {
+        int x = std::min(std::max((int)shape.part(i).x(), 0), size.width-1);
+        int y = std::min(std::max((int)shape.part(i).y(), 0), size.height-1);
+        points.push_back(Point(x, y));
     }
-    for(std::vector<Point2f>::iterator it = points1.begin(); it != points1.end(); it++) {
-        subdiv1.insert(*it);
+
+    // Add 8 border points
+    points.push_back(Point(0,0));
+    points.push_back(Point(size.width/2,0));
+    points.push_back(Point(size.width-1,0));
+    points.push_back(Point(0,size.height/2));
+    points.push_back(Point(size.width/2,size.height/2));
+    points.push_back(Point(0,size.height-1));
+    points.push_back(Point(size.width/2,size.height-1));
+    points.push_back(Point(size.width-1,size.height-1));
+    return points;
+}
+
+// Delaunay triangulation of points inside an image of the given size,
+// as a list of point indices
+void triangulate(const std::vector<Point2f> &points, Size size, std::vector<std::array<int, 3> > &triindexlist)
+{
+    Rect rect(0, 0, size.width, size.height);
+    Subdiv2D subdiv(rect);
+    for(std::vector<Point2f>::const_iterator it = points.begin(); it != points.end(); it++) {
+        subdiv.insert(*it);
     }
-    
-    // Perform Delaunay triangulation and get the list of point indice
+
     std::vector<Point2f> pt(3);
-    std::vector<std::array<int, 3>> triindexlist;
-    // 
-    
-    std::vector<Vec6f> triangleList1;
-    subdiv1.getTriangleList(triangleList1);
-    for( size_t i = 0; i < triangleList1.size(); i++ )
+    std::vector<Vec6f> triangleList;
+    subdiv.getTriangleList(triangleList);
+    triindexlist.clear();
+    for( size_t i = 0; i < triangleList.size(); i++ )
     {
-        Vec6f t = triangleList1[i];
+        Vec6f t = triangleList[i];
         pt[0] = Point(cvRound(t[0]), cvRound(t[1]));
         pt[1] = Point(cvRound(t[2]), cvRound(t[3]));
         pt[2] = Point(cvRound(t[4]), cvRound(t[5]));
-         
+
         // Consider the points in the region only
-        if ( rect1.contains(pt[0]) && rect1.contains(pt[1]) && rect1.contains(pt[2]))
+        if ( rect.contains(pt[0]) && rect.contains(pt[1]) && rect.contains(pt[2]))
         {
-            line(img1, pt[0], pt[1], cv::Scalar(0, 255, 0), 1, CV_AA, 0);
-            line(img1, pt[1], pt[2], cv::Scalar(0, 255, 0), 1, CV_AA, 0);
-            line(img1, pt[2], pt[0], cv::Scalar(0, 255, 0), 1, CV_AA, 0);
-            
             // Find the corresponding indice of the points
             // TODO: Kind of brute force search here -- need refinement
             std::array<int, 3> idx;
-            idx[0]=-1;idx[1]=-1;idx[2]=-1;
-            for(std::vector<Point2f>::iterator it = points1.begin(); it != points1.end(); it++)
-                if((*it) == pt[0])
-                    idx[0] = it - points1.begin();
-            for(std::vector<Point2f>::iterator it = points1.begin(); it != points1.end(); it++)
-                if((*it) == pt[1]) 
-                    idx[1] = it - points1.begin();           
-            for(std::vector<Point2f>::iterator it = points1.begin(); it != points1.end(); it++)
-                if((*it) == pt[2]) 
-                    idx[2] = it - points1.begin();
+            for(int k = 0; k < 3; k++) {
+                idx[k] = -1;
+                for(std::vector<Point2f>::const_iterator it = points.begin(); it != points.end(); it++)
+                    if((*it) == pt[k])
+                        idx[k] = it - points.begin();
+            }
             assert(idx[0]!=-1&&idx[1]!=-1&&idx[2]!=-1);
             triindexlist.push_back(idx);
-            
         }
     }
-/*
-    // Print the list of triangle point indices
-    for(std::vector<std::array<int, 3>>::iterator it = triindexlist.begin(); \
-        it != triindexlist.end(); it++) {
-            cout << (*it)[0] << " " << (*it)[1] << " " << (*it)[2] << endl;
+}
+
+// Debug overlays: landmarks as red points, triangles as green edges
+Mat drawLandmarks(const Mat &img, const std::vector<Point2f> &points)
+{
+    Mat vis = img.clone();
+    for(int i = 0; i < 68; i++)
+        drawpoint(vis, points[i], cv::Scalar(0, 0, 255));
+    return vis;
+}
+
+Mat drawTriangles(const Mat &img, const std::vector<Point2f> &points, \
+    const std::vector<std::array<int, 3> > &triindexlist)
+{
+    Mat vis = img.clone();
+    for(size_t i = 0; i < triindexlist.size(); i++)
+        for(int k = 0; k < 3; k++)
+            line(vis, points[triindexlist[i][k]], points[triindexlist[i][(k+1)%3]], \
+                cv::Scalar(0, 255, 0), 1, CV_AA, 0);
+    return vis;
+}
+
+// Writes the overlays next to the output out, as <stem>_landmarks1.jpg,
+// <stem>_landmarks2.jpg, <stem>_delaunay1.jpg and <stem>_delaunay2.jpg.
+// The morph uses the triangles of img1 only; those of img2 are drawn for
+// comparison.
+bool writeOverlays(const std::string &out, const Mat &img1, const Mat &img2, const std::vector<Point2f> &points1, \
+    const std::vector<Point2f> &points2, const std::vector<std::array<int, 3> > &triindexlist)
+{
+    size_t dot = out.find_last_of("./");
+    std::string stem = dot != std::string::npos && out[dot] == '.' ? out.substr(0, dot) : out;
+    std::vector<std::array<int, 3> > triindexlist2;
+    triangulate(points2, img2.size(), triindexlist2);
+
+    bool ok = imwrite(stem + "_landmarks1.jpg", drawLandmarks(img1, points1));
+    ok = imwrite(stem + "_landmarks2.jpg", drawLandmarks(img2, points2)) && ok;
+    ok = imwrite(stem + "_delaunay1.jpg", drawTriangles(img1, points1, triindexlist)) && ok;
+    ok = imwrite(stem + "_delaunay2.jpg", drawTriangles(img2, points2, triindexlist2)) && ok;
+    if(!ok)
+        fprintf(stderr, "Cannot write the overlays of %s.\n", out.c_str());
+    return ok;
+}
+
+// Headless morph, used by the batch mode: morphs img1 (resized to img2)
+// into img2 at alpha and writes the result to out, and the overlays with
+// it when asked for. Nothing is drawn otherwise.
+bool morphJob(FaceModels &models, const std::string &path1, const std::string &path2, double alpha, \
+    const std::string &out, bool overlays, StageTimes &times)
+{
+    Mat img1 = imread(path1, 1);
+    Mat img2 = imread(path2, 1);
+    if(img1.empty() || img2.empty()) {
+        fprintf(stderr, "Cannot read %s.\n", img1.empty() ? path1.c_str() : path2.c_str());
+        return false;
+    }
+    resize(img1, img1, img2.size());
+
+    std::vector<Point2f> points1 = findLandmarks(models, img1, times);
+    std::vector<Point2f> points2 = findLandmarks(models, img2, times);
+    if(points1.empty() || points2.empty()) {
+        fprintf(stderr, "No face found in %s.\n", points1.empty() ? path1.c_str() : path2.c_str());
+        return false;
     }
-*/
-    // Set region of calculation of img2
-    Size size2 = img2.size();
-    Rect rect2(0, 0, size2.width, size2.height);
-    Subdiv2D subdiv2(rect2);
-    std::vector<Point2f> points2;
-    
-    if(!shapes2.empty()) {
-        // Add 68 facial feature points
-        for(int i = 0; i < 68; i++)
-            points2.push_back(Point(shapes2[0].part(i).x(), shapes2[0].part(i).y()));
-        
-        // Add 8 border points
-        points2.push_back(Point(0,0));
-        points2.push_back(Point(size2.width/2,0));
-        points2.push_back(Point(size2.width-1,0));
-        points2.push_back(Point(0,size2.height/2));
-        points2.push_back(Point(size2.width/2,size2.height/2));
-        points2.push_back(Point(0,size2.height-1));
-        points2.push_back(Point(size2.width/2,size2.height-1));
-        points2.push_back(Point(size2.width-1,size2.height-1));
+
+    double t0 = (double)getTickCount();
+    std::vector<std::array<int, 3> > triindexlist;
+    triangulate(points1, img1.size(), triindexlist);
+    times.triangulate += msSince(t0);
+
+    t0 = (double)getTickCount();
+    Mat img1f, img2f, imgMorph;
+    img1.convertTo(img1f, CV_32F);
+    img2.convertTo(img2f, CV_32F);
+    MeshMorph mesh;
+    mesh.init(img1f, img2f, points1, points2, triindexlist);
+    mesh.setAlpha(alpha);
+    mesh.render(imgMorph);
+    times.warp += msSince(t0);
+
+    Mat result;
+    imgMorph.convertTo(result, CV_8U);
+    if(!imwrite(out, result)) {
+        fprintf(stderr, "Cannot write %s.\n", out.c_str());
+        return false;
     }
-    for(std::vector<Point2f>::iterator it = points2.begin(); it != points2.end(); it++) {
-        subdiv2.insert(*it);
+    return !overlays || writeOverlays(out, img1, img2, points1, points2, triindexlist);
+}
+
+// Batch mode: one job per line of the manifest, "<img1> <img2> <alpha>
+// [<output>]", # for comments; "-" reads the jobs from stdin as they come,
+// so another process can feed a resident one through a pipe. A line with
+// the stage times is printed and flushed after every job.
+int runBatch(FaceModels &models, const char *manifest, bool overlays)
+{
+    std::ifstream file;
+    bool fromStdin = !strcmp(manifest, "-");
+    if(!fromStdin) {
+        file.open(manifest);
+        if(!file) {
+            fprintf(stderr, "Cannot read %s.\n", manifest);
+            return -1;
+        }
     }
-    
-    std::vector<Vec6f> triangleList2;
-    subdiv2.getTriangleList(triangleList2);
-    
-    for( size_t i = 0; i < triangleList2.size(); i++ )
-    {
-        Vec6f t = triangleList2[i];
-        pt[0] = Point(cvRound(t[0]), cvRound(t[1]));
-        pt[1] = Point(cvRound(t[2]), cvRound(t[3]));
-        pt[2] = Point(cvRound(t[4]), cvRound(t[5]));
-         
-        if ( rect2.contains(pt[0]) && rect2.contains(pt[1]) && rect2.contains(pt[2]))
-        {
-            line(img2, pt[0], pt[1], cv::Scalar(0, 255, 0), 1, CV_AA, 0);
-            line(img2, pt[1], pt[2], cv::Scalar(0, 255, 0), 1, CV_AA, 0);
-            line(img2, pt[2], pt[0], cv::Scalar(0, 255, 0), 1, CV_AA, 0);
+    std::istream &in = fromStdin ? std::cin : file;
+
+    int jobs = 0, failed = 0;
+    StageTimes total;
+    std::string text;
+    while(getline(in, text)) {
+        std::istringstream fields(text);
+        std::string path1, path2, out;
+        double alpha;
+        if(!(fields >> path1) || path1[0] == '#')
+            continue;
+        jobs++;
+        if(!(fields >> path2 >> alpha)) {
+            fprintf(stderr, "Bad job: %s\n", text.c_str());
+            printf("job %d: failed\n", jobs);
+            fflush(stdout);
+            failed++;
+            continue;
+        }
+        if(!(fields >> out)) {
+            char name[32];
+            snprintf(name, sizeof(name), "morph_%d.jpg", jobs);
+            out = name;
+        }
+
+        // an exception fails the job only, not the jobs still to come
+        StageTimes times;
+        bool ok = false;
+        try {
+            ok = morphJob(models, path1, path2, alpha, out, overlays, times);
+        }
+        catch(std::exception &e) {
+            fprintf(stderr, "Job %d: %s\n", jobs, e.what());
+        }
+        if(!ok) {
+            printf("job %d: failed\n", jobs);
+            failed++;
+        }
+        else {
+            printf("job %d: %s detect %.1f ms, landmark %.1f ms, triangulate %.1f ms, warp %.1f ms\n", \
+                jobs, out.c_str(), times.detect, times.landmark, times.triangulate, times.warp);
+            total.detect += times.detect;
+            total.landmark += times.landmark;
+            total.triangulate += times.triangulate;
+            total.warp += times.warp;
+        }
+        fflush(stdout);
+    }
+
+    int done = jobs - failed;
+    printf("%d jobs, %d failed", jobs, failed);
+    if(done)
+        printf("; mean detect %.1f ms, landmark %.1f ms, triangulate %.1f ms, warp %.1f ms", \
+            total.detect/done, total.landmark/done, total.triangulate/done, total.warp/done);
+    printf("\n");
+    return failed ? -1 : 0;
+}
+
+// Renders frames first..first+n-1 of a morph sequence, frame first+i into
+// slot i; each slot has its own mesh and float and 8-bit buffer, reused by
+// the next group of frames. With a file name pattern the frames are also
+// written, from the worker threads.
+class FrameBody : public ParallelLoopBody {
+public:
+    FrameBody(std::vector<MeshMorph> &meshes, int nframes, int first, const char *pattern, \
+        std::vector<Mat> &morphs, std::vector<Mat> &frames, std::vector<char> &failed) :
+        meshes_(meshes), nframes_(nframes), first_(first), pattern_(pattern), morphs_(morphs), \
+        frames_(frames), failed_(failed) {}
+
+    void operator()(const Range &range) const {
+        for(int i = range.start; i < range.end; i++) {
+            int f = first_ + i;
+            double alpha = nframes_ > 1 ? (double)f / (nframes_ - 1) : 0;
+            meshes_[i].setAlpha(alpha);
+            meshes_[i].render(morphs_[i], false);  // frames are the parallel unit here
+            morphs_[i].convertTo(frames_[i], CV_8U);
+            failed_[i] = 0;
+            if(pattern_) {
+                char name[1024];
+                snprintf(name, sizeof(name), pattern_, f);
+                if(!imwrite(name, frames_[i])) {
+                    fprintf(stderr, "Cannot write %s.\n", name);
+                    failed_[i] = 1;
+                }
+            }
         }
     }
 
+private:
+    std::vector<MeshMorph> &meshes_;
+    int nframes_, first_;
+    const char *pattern_;
+    std::vector<Mat> &morphs_, &frames_;
+    std::vector<char> &failed_;
+};
+
+// true for a file name pattern with a single integer conversion, like
+// frame_%03d.jpg
+static bool framePattern(const char *pattern)
+{
+    int conversions = 0;
+    for(const char *p = strchr(pattern, '%'); p; p = strchr(p, '%')) {
+        p++;
+        if(*p == '%') {
+            p++;
+            continue;
+        }
+        while(*p >= '0' && *p <= '9')
+            p++;
+        if(*p != 'd')
+            return false;
+        conversions++;
+    }
+    return conversions == 1;
+}
+
+// Sequence mode: nframes frames from img1 (alpha 0) to img2 (alpha 1).
+// Landmarks and triangles are found once; the frames are rendered a group
+// at a time, one frame per thread. out is a file name pattern for numbered
+// images, or "-" for raw BGR frames on stdout, e.g. to pipe into a video
+// encoder.
+int runSequence(FaceModels &models, const char *path1, const char *path2, int nframes, \
+    const char *out, bool overlays)
+{
+    bool raw = !strcmp(out, "-");
+    if(!raw && !framePattern(out)) {
+        fprintf(stderr, "--out needs a pattern with one %%d, like frame_%%03d.jpg, or -.\n");
+        return -1;
+    }
+
+    Mat img1 = imread(path1, 1);
+    Mat img2 = imread(path2, 1);
+    if(img1.empty() || img2.empty()) {
+        fprintf(stderr, "Cannot read %s.\n", img1.empty() ? path1 : path2);
+        return -1;
+    }
+    resize(img1, img1, img2.size());
+
+    StageTimes times;
+    std::vector<Point2f> points1 = findLandmarks(models, img1, times);
+    std::vector<Point2f> points2 = findLandmarks(models, img2, times);
+    if(points1.empty() || points2.empty()) {
+        fprintf(stderr, "No face found in %s.\n", points1.empty() ? path1 : path2);
+        return -1;
+    }
+
+    double t0 = (double)getTickCount();
+    std::vector<std::array<int, 3> > triindexlist;
+    triangulate(points1, img1.size(), triindexlist);
+    times.triangulate += msSince(t0);
+    if(overlays && !writeOverlays("sequence", img1, img2, points1, points2, triindexlist))
+        return -1;
+
+    t0 = (double)getTickCount();
+    Mat img1f, img2f;
+    img1.convertTo(img1f, CV_32F);
+    img2.convertTo(img2f, CV_32F);
+    int slots = std::min(nframes, std::max(1, getNumThreads()));
+    MeshMorph mesh;
+    mesh.init(img1f, img2f, points1, points2, triindexlist);
+    std::vector<MeshMorph> meshes(slots, mesh);
+    std::vector<Mat> morphs(slots), frames(slots);
+    std::vector<char> failed(slots);
+    int nfailed = 0;
+    for(int first = 0; first < nframes; first += slots) {
+        int n = std::min(slots, nframes - first);
+        parallel_for_(Range(0, n), FrameBody(meshes, nframes, first, raw ? 0 : out, morphs, frames, failed));
+        for(int i = 0; i < n; i++) {
+            // frames go to the pipe in order, one group at a time
+            if(raw && fwrite(frames[i].data, frames[i].elemSize(), frames[i].total(), stdout) != frames[i].total())
+                failed[i] = 1;
+            nfailed += failed[i];
+        }
+    }
+    if(raw)
+        fflush(stdout);
+    times.warp = msSince(t0);
+
+    fprintf(stderr, "%d frames of %dx%d, %d failed; detect %.1f ms, landmark %.1f ms, triangulate %.1f ms, " \
+        "render %.1f ms (%.1f ms per frame)\n", nframes, img2.cols, img2.rows, nfailed, times.detect, \
+        times.landmark, times.triangulate, times.warp, times.warp / nframes);
+    return nfailed ? -1 : 0;
+}
+
+void usage() {
+    fprintf(stderr, "Usage: ./face_landmark_detection [options] <img1_path> <img2_path> <alpha>\n");
+    fprintf(stderr, "       ./face_landmark_detection [options] --frames <N> <img1_path> <img2_path>\n");
+    fprintf(stderr, "       ./face_landmark_detection [options] --batch <manifest|->\n");
+    fprintf(stderr, "Options: [--model <file>] [--headless] [--out <file>] [--overlays]\n");
+}
+
+int main(int argc, char **argv) {
+    help();
+
+    const char *modelPath = DEFAULT_MODEL;
+    const char *manifest = 0;
+    const char *out = 0;
+    int nframes = 0;
+    bool headless = false, overlays = false;
+    std::vector<char *> args;
+    for(int a = 1; a < argc; a++) {
+        if(!strcmp(argv[a], "--model") && a+1 < argc)
+            modelPath = argv[++a];
+        else if(!strcmp(argv[a], "--batch") && a+1 < argc)
+            manifest = argv[++a];
+        else if(!strcmp(argv[a], "--frames") && a+1 < argc)
+            nframes = atoi(argv[++a]);
+        else if(!strcmp(argv[a], "--out") && a+1 < argc)
+            out = argv[++a];
+        else if(!strcmp(argv[a], "--headless"))
+            headless = true;
+        else if(!strcmp(argv[a], "--overlays"))
+            overlays = true;
+        else
+            args.push_back(argv[a]);
+    }
+    bool valid = manifest ? args.empty() && !out && !nframes : \
+        nframes ? nframes > 0 && args.size() == 2 : args.size() == 3;
+    if(!valid) {
+        fprintf(stderr, "Invalid argument.\n");
+        usage();
+        return -1;
+    }
+
+    //----- Face Landmark Detection -----//
+    // Load face detection and pose estimation models, once for all jobs
+    FaceModels models;
+    double t0 = (double)getTickCount();
+    if(!loadModels(models, modelPath))
+        return -1;
+    fprintf(stderr, "Models loaded in %.1f ms.\n", msSince(t0));
+
+    if(manifest)
+        return runBatch(models, manifest, overlays);
+    if(nframes)
+        return runSequence(models, args[0], args[1], nframes, out ? out : "frame_%03d.jpg", overlays);
+
+    // alpha: linear combination factor
+    double alpha = atof(args[2]);
+    StageTimes times;
+    if(headless) {
+        if(!morphJob(models, args[0], args[1], alpha, out ? out : "morph.jpg", overlays, times))
+            return -1;
+        fprintf(stderr, "detect %.1f ms, landmark %.1f ms, triangulate %.1f ms, warp %.1f ms\n", \
+            times.detect, times.landmark, times.triangulate, times.warp);
+        return 0;
+    }
+
+    Mat img1, img2;
+    img1 = imread(args[0], 1);
+    img2 = imread(args[1], 1);
+    if(img1.empty() || img2.empty()) {
+        fprintf(stderr, "Cannot read %s.\n", img1.empty() ? args[0] : args[1]);
+        return -1;
+    }
+    resize(img1, img1, img2.size());
+
+    std::vector<Point2f> points1 = findLandmarks(models, img1, times);
+    std::vector<Point2f> points2 = findLandmarks(models, img2, times);
+    if(points1.empty() || points2.empty()) {
+        fprintf(stderr, "No face found in %s.\n", points1.empty() ? args[0] : args[1]);
+        return -1;
+    }
+
+    // Draw feature points on copies of the images
+    namedWindow("Face1", WINDOW_AUTOSIZE);
+    namedWindow("Face2", WINDOW_AUTOSIZE);
+    imshow("Face1", drawLandmarks(img1, points1));
+    imshow("Face2", drawLandmarks(img2, points2));
+    waitKey(0);
+
+    //----- Delaunay Triangulation -----//
+    // The morph uses the triangles of img1 only; those of img2 are shown
+    // for comparison
+    t0 = (double)getTickCount();
+    std::vector<std::array<int, 3> > triindexlist;
+    triangulate(points1, img1.size(), triindexlist);
+    times.triangulate += msSince(t0);
+    std::vector<std::array<int, 3> > triindexlist2;
+    triangulate(points2, img2.size(), triindexlist2);
 
     // Display it all on the screen
-    imshow("Face1", img1);
-    imshow("Face2", img2);
-    
+    imshow("Face1", drawTriangles(img1, points1, triindexlist));
+    imshow("Face2", drawTriangles(img2, points2, triindexlist2));
+
     waitKey(0);
 
     //----- Morphing -----//
-    // alpha: linear combination factor
-    double alpha = atof(argv[3]);
-    
     // Convert to floating-point:
     // We do floating-point calculation during linear combination
-    img1_orig.convertTo(img1, CV_32F);
-    img2_orig.convertTo(img2, CV_32F);
-    
-    // imgMorph: the morphed image
-    Mat imgMorph = Mat::zeros(img1.size(), CV_32FC3);
-    std::vector<Point2f> points;
-
-
-
-    // Find the corresponding position in imgMorph
-    for(int i = 0; i < points1.size(); i++)
-    {
-        float x, y;
-        x = (1-alpha) * points1[i].x + alpha * points2[i].x;
-        y = (1-alpha) * points1[i].y + alpha * points2[i].y;
-        
-        points.push_back(Point2f(x,y));
-    }  
-    
+    t0 = (double)getTickCount();
+    Mat img1f, img2f, imgMorph;
+    img1.convertTo(img1f, CV_32F);
+    img2.convertTo(img2f, CV_32F);
     // Note that we only have one copy of the list of the point indice
     // since the feature points found by get_frontal_face_detector()
     // are always in the same order
-    for(std::vector<std::array<int, 3>>::iterator it = triindexlist.begin(); \
-        it != triindexlist.end(); it++) {
-        
-        // Triangles (t1:img1|t2:img2|t:imgMorph)
-        std::vector<Point2f> t1, t2, t;
-        int x, y, z;
-        x=(*it)[0]; y=(*it)[1]; z=(*it)[2];
-        
-        // Triangle corners for image 1.
-        t1.push_back( points1[x] );
-        t1.push_back( points1[y] );
-        t1.push_back( points1[z] );
-        
-        // Triangle corners for image 2.
-        t2.push_back( points2[x] );
-        t2.push_back( points2[y] );
-        t2.push_back( points2[z] );
-        
-        // Triangle corners for morphed image.
-        t.push_back( points[x] );
-        t.push_back( points[y] );
-        t.push_back( points[z] );
-        
-        morphTriangle(img1, img2, imgMorph, t1, t2, t, alpha);
+    MeshMorph mesh;
+    mesh.init(img1f, img2f, points1, points2, triindexlist);
+    mesh.setAlpha(alpha);
+    mesh.render(imgMorph);
+    times.warp += msSince(t0);
+    fprintf(stderr, "detect %.1f ms, landmark %.1f ms, triangulate %.1f ms, warp %.1f ms\n", \
+        times.detect, times.landmark, times.triangulate, times.warp);
+
+    if(out || overlays) {
+        std::string path = out ? out : "morph.jpg";
+        Mat result;
+        imgMorph.convertTo(result, CV_8U);
+        if(!imwrite(path, result)) {
+            fprintf(stderr, "Cannot write %s.\n", path.c_str());
+            return -1;
+        }
+        if(overlays && !writeOverlays(path, img1, img2, points1, points2, triindexlist))
+            return -1;
     }
-    
+
     namedWindow("Morphed Face", WINDOW_AUTOSIZE);
     imshow("Morphed Face", imgMorph / 255.0);
     waitKey(0);
 
     return 0;
-}  
+}
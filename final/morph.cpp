@@ -0,0 +1,322 @@
+#include <cassert>
+#include <algorithm>
+#include <utility>
+#include <opencv2/opencv.hpp>
+#include "morph.h"
+
+using namespace std;
+using namespace cv;
+
+// subpixel steps of the fixed-point corners; pixel centers are at
+// multiples of it
+#define MESH_SUBPIXEL 256
+
+static inline long long floorDiv(long long a, long long b)
+{
+    // b > 0
+    return a >= 0 ? a / b : -((-a + b - 1) / b);
+}
+
+static inline long long ceilDiv(long long a, long long b)
+{
+    return -floorDiv(-a, b);
+}
+
+// affine map taking triangle p to triangle q: the barycentric coordinates
+// of a point in p, applied to the corners of q
+static bool affineMap(const Point2f *p, const Point2f *q, float *m)
+{
+    double d1x = p[1].x - p[0].x, d1y = p[1].y - p[0].y;
+    double d2x = p[2].x - p[0].x, d2y = p[2].y - p[0].y;
+    double det = d1x * d2y - d1y * d2x;
+    if(det == 0)
+        return false;
+    double l1x = d2y / det, l1y = -d2x / det, l2x = -d1y / det, l2y = d1x / det;
+    double e1x = q[1].x - q[0].x, e1y = q[1].y - q[0].y;
+    double e2x = q[2].x - q[0].x, e2y = q[2].y - q[0].y;
+    double a = e1x * l1x + e2x * l2x, b = e1x * l1y + e2x * l2y;
+    double c = e1y * l1x + e2y * l2x, d = e1y * l1y + e2y * l2y;
+    m[0] = (float)a;
+    m[1] = (float)b;
+    m[2] = (float)(q[0].x - a * p[0].x - b * p[0].y);
+    m[3] = (float)c;
+    m[4] = (float)d;
+    m[5] = (float)(q[0].y - c * p[0].x - d * p[0].y);
+    return true;
+}
+
+// bilinear sample of a CV_32FC3 image, clamped to the border (only reached
+// by rounding at the image edge)
+static inline void bilinear(const Mat &img, float x, float y, float *out)
+{
+    int x0 = cvFloor(x), y0 = cvFloor(y);
+    float fx = x - x0, fy = y - y0;
+    int x1 = std::min(std::max(x0 + 1, 0), img.cols - 1);
+    int y1 = std::min(std::max(y0 + 1, 0), img.rows - 1);
+    x0 = std::min(std::max(x0, 0), img.cols - 1);
+    y0 = std::min(std::max(y0, 0), img.rows - 1);
+    const float *r0 = img.ptr<float>(y0), *r1 = img.ptr<float>(y1);
+    for(int c = 0; c < 3; c++) {
+        float top = r0[3*x0+c] + (r0[3*x1+c] - r0[3*x0+c]) * fx;
+        float bottom = r1[3*x0+c] + (r1[3*x1+c] - r1[3*x0+c]) * fx;
+        out[c] = top + (bottom - top) * fy;
+    }
+}
+
+// same, for (x, y) in [0, cols-1) x [0, rows-1), so that no clamping is
+// needed; base and step (in floats) address the image
+static inline void bilinearInside(const float *base, size_t step, float x, float y, float *out)
+{
+    int ix = (int)x, iy = (int)y;
+    float fx = x - ix, fy = y - iy;
+    const float *r0 = base + iy * step + 3 * ix, *r1 = r0 + step;
+    for(int c = 0; c < 3; c++) {
+        float top = r0[c] + (r0[c+3] - r0[c]) * fx;
+        float bottom = r1[c] + (r1[c+3] - r1[c]) * fx;
+        out[c] = top + (bottom - top) * fy;
+    }
+}
+
+// Pixel centers of a triangle within clip, row by row. Edge k from corner
+// k to k+1 is E(x, y) = A*x + B*y + D at the pixel center (x, y); a center
+// is inside when all three E are > 0, or = 0 on an edge that owns its
+// centers.
+struct TriangleSpans {
+    long long A[3], B[3], D[3];
+    Rect clip;
+    int y0, y1;                 // rows to try
+
+    TriangleSpans(const MeshTriangle &t, const Rect &c) : clip(c)
+    {
+        const long long S = MESH_SUBPIXEL;
+        for(int k = 0; k < 3; k++) {
+            int k1 = (k + 1) % 3;
+            long long dX = t.X[k1] - t.X[k], dY = t.Y[k1] - t.Y[k];
+            A[k] = -S * dY;
+            B[k] = S * dX;
+            D[k] = dY * t.X[k] - dX * t.Y[k] - (t.owns[k] ? 0 : 1);
+        }
+        long long top = std::min(t.Y[0], std::min(t.Y[1], t.Y[2]));
+        long long bottom = std::max(t.Y[0], std::max(t.Y[1], t.Y[2]));
+        y0 = (int)std::max((long long)clip.y, ceilDiv(top, S));
+        y1 = (int)std::min((long long)clip.y + clip.height - 1, floorDiv(bottom, S));
+    }
+
+    // columns x0..x1 of row y, false when the row has none
+    bool row(int y, int &x0, int &x1) const
+    {
+        // every edge bounds x from one side
+        long long xl = clip.x, xr = clip.x + clip.width - 1;
+        for(int k = 0; k < 3; k++) {
+            long long c = B[k] * y + D[k];      // A*x + c >= 0
+            if(A[k] > 0)
+                xl = std::max(xl, ceilDiv(-c, A[k]));
+            else if(A[k] < 0)
+                xr = std::min(xr, floorDiv(c, -A[k]));
+            else if(c < 0)
+                return false;
+        }
+        if(xl > xr)
+            return false;
+        x0 = (int)xl;
+        x1 = (int)xr;
+        return true;
+    }
+};
+
+void MeshMorph::init(const Mat &img1, const Mat &img2, const std::vector<Point2f> &points1, \
+    const std::vector<Point2f> &points2, const std::vector<std::array<int, 3> > &triangles)
+{
+    assert(img1.type() == CV_32FC3 && img2.type() == CV_32FC3 && img1.size() == img2.size());
+    assert(points1.size() == points2.size());
+    img1_ = img1;
+    img2_ = img2;
+    points1_ = points1;
+    points2_ = points2;
+    points_.resize(points1.size());
+    triangles_.resize(triangles.size());
+
+    for(size_t i = 0; i < triangles.size(); i++) {
+        for(int k = 0; k < 3; k++)
+            triangles_[i].v[k] = triangles[i][k];
+        triangles_[i].empty = true;
+    }
+    tilesX_ = (img1.cols + MESH_TILE - 1) / MESH_TILE;
+    tiles_.resize(tilesX_ * ((img1.rows + MESH_TILE - 1) / MESH_TILE));
+    alpha_ = 0;
+}
+
+void MeshMorph::setAlpha(double alpha)
+{
+    const long long S = MESH_SUBPIXEL;
+    const long long lastX = (img1_.cols - 1) * S, lastY = (img1_.rows - 1) * S;
+    alpha_ = (float)alpha;
+    for(size_t i = 0; i < points_.size(); i++) {
+        points_[i].x = (1-alpha) * points1_[i].x + alpha * points2_[i].x;
+        points_[i].y = (1-alpha) * points1_[i].y + alpha * points2_[i].y;
+    }
+
+    for(size_t i = 0; i < triangles_.size(); i++) {
+        MeshTriangle &t = triangles_[i];
+        Point2f p[3], q1[3], q2[3];
+        for(int k = 0; k < 3; k++) {
+            p[k] = points_[t.v[k]];
+            q1[k] = points1_[t.v[k]];
+            q2[k] = points2_[t.v[k]];
+            // corners shared by two triangles snap to the same grid point
+            t.X[k] = cvRound(p[k].x * MESH_SUBPIXEL);
+            t.Y[k] = cvRound(p[k].y * MESH_SUBPIXEL);
+            // corners on the last column or row move out by one step, so
+            // that the centers there are inside the mesh rather than on its
+            // right or bottom outline, which the tie rule leaves to nobody
+            if(t.X[k] == lastX)
+                t.X[k]++;
+            if(t.Y[k] == lastY)
+                t.Y[k]++;
+        }
+        // counter-clockwise on screen (y down), so that the inside is where
+        // all three edge functions are positive; swapping corners 1 and 2
+        // reverses the edges
+        long long area = (t.X[1] - t.X[0]) * (t.Y[2] - t.Y[0]) - (t.Y[1] - t.Y[0]) * (t.X[2] - t.X[0]);
+        if(area < 0) {
+            std::swap(t.X[1], t.X[2]);
+            std::swap(t.Y[1], t.Y[2]);
+        }
+        // top-left rule: of two triangles sharing an edge exactly one owns
+        // it, as they run it in opposite directions, and of the fan around a
+        // corner exactly one owns the corner; on the outline only left and
+        // top edges own their centers
+        for(int k = 0; k < 3; k++) {
+            int k1 = (k + 1) % 3;
+            long long dX = t.X[k1] - t.X[k], dY = t.Y[k1] - t.Y[k];
+            t.owns[k] = dY < 0 || (dY == 0 && dX > 0);
+        }
+        t.empty = area == 0 || !affineMap(p, q1, t.m1) || !affineMap(p, q2, t.m2);
+    }
+
+    // bin by the pixel centers of the bounding boxes; the lists keep their
+    // capacity, and triangle order, from one alpha to the next
+    for(size_t i = 0; i < tiles_.size(); i++)
+        tiles_[i].clear();
+    int tilesY = (int)tiles_.size() / tilesX_;
+    for(size_t i = 0; i < triangles_.size(); i++) {
+        const MeshTriangle &t = triangles_[i];
+        if(t.empty)
+            continue;
+        long long x0 = ceilDiv(std::min(t.X[0], std::min(t.X[1], t.X[2])), S);
+        long long x1 = floorDiv(std::max(t.X[0], std::max(t.X[1], t.X[2])), S);
+        long long y0 = ceilDiv(std::min(t.Y[0], std::min(t.Y[1], t.Y[2])), S);
+        long long y1 = floorDiv(std::max(t.Y[0], std::max(t.Y[1], t.Y[2])), S);
+        if(x1 < 0 || y1 < 0 || x0 > x1 || y0 > y1)
+            continue;
+        int tx0 = (int)std::max(x0, 0LL) / MESH_TILE, tx1 = (int)std::min(x1 / MESH_TILE, (long long)tilesX_ - 1);
+        int ty0 = (int)std::max(y0, 0LL) / MESH_TILE, ty1 = (int)std::min(y1 / MESH_TILE, (long long)tilesY - 1);
+        for(int ty = ty0; ty <= ty1; ty++)
+            for(int tx = tx0; tx <= tx1; tx++)
+                tiles_[ty * tilesX_ + tx].push_back((int)i);
+    }
+}
+
+// draws a range of tiles; tiles do not share pixels, so the threads never
+// write the same place
+class MeshTileBody : public ParallelLoopBody {
+public:
+    MeshTileBody(const MeshMorph &mesh, Mat &dst) : mesh_(mesh), dst_(dst) {}
+
+    void operator()(const Range &range) const {
+        for(int i = range.start; i < range.end; i++)
+            mesh_.drawTile(i, dst_);
+    }
+
+private:
+    const MeshMorph &mesh_;
+    Mat &dst_;
+};
+
+void MeshMorph::render(Mat &dst, bool parallel) const
+{
+    if(dst.size() != img1_.size() || dst.type() != CV_32FC3) {
+        dst.create(img1_.size(), CV_32FC3);
+        dst.setTo(Scalar::all(0));
+    }
+    if(parallel)
+        parallel_for_(Range(0, tileCount()), MeshTileBody(*this, dst));
+    else {
+        Rect all(0, 0, dst.cols, dst.rows);
+        for(size_t i = 0; i < triangles_.size(); i++)
+            drawTriangle(triangles_[i], all, dst);
+    }
+}
+
+void MeshMorph::drawTile(int i, Mat &dst) const
+{
+    int x = (i % tilesX_) * MESH_TILE, y = (i / tilesX_) * MESH_TILE;
+    Rect clip(x, y, std::min(MESH_TILE, dst.cols - x), std::min(MESH_TILE, dst.rows - y));
+    const std::vector<int> &list = tiles_[i];
+    for(size_t k = 0; k < list.size(); k++)
+        drawTriangle(triangles_[list[k]], clip, dst);
+}
+
+void MeshMorph::coverage(Mat &count) const
+{
+    count.create(img1_.size(), CV_8U);
+    count.setTo(Scalar::all(0));
+    Rect all(0, 0, count.cols, count.rows);
+    for(size_t i = 0; i < triangles_.size(); i++) {
+        if(triangles_[i].empty)
+            continue;
+        TriangleSpans spans(triangles_[i], all);
+        for(int y = spans.y0; y <= spans.y1; y++) {
+            int x0, x1;
+            if(!spans.row(y, x0, x1))
+                continue;
+            uchar *c = count.ptr<uchar>(y);
+            for(int x = x0; x <= x1; x++)
+                c[x] = (uchar)std::min(c[x] + 1, 255);
+        }
+    }
+}
+
+void MeshMorph::drawTriangle(const MeshTriangle &t, const Rect &clip, Mat &dst) const
+{
+    if(t.empty)
+        return;
+    TriangleSpans spans(t, clip);
+    float a = 1 - alpha_, b = alpha_;
+    const float *m1 = t.m1, *m2 = t.m2;
+    const float *base1 = img1_.ptr<float>(), *base2 = img2_.ptr<float>();
+    size_t step1 = img1_.step / sizeof(float), step2 = img2_.step / sizeof(float);
+    float maxX = (float)(img1_.cols - 1), maxY = (float)(img1_.rows - 1);
+
+    for(int y = spans.y0; y <= spans.y1; y++) {
+        int x0, x1;
+        if(!spans.row(y, x0, x1))
+            continue;
+        float *d = dst.ptr<float>(y);
+        float u1 = m1[1] * y + m1[2], v1 = m1[4] * y + m1[5];
+        float u2 = m2[1] * y + m2[2], v2 = m2[4] * y + m2[5];
+
+        // the source positions are affine along the span, so its ends tell
+        // whether all of them are clear of the last row and column
+        float ends[8] = {m1[0] * x0 + u1, m1[3] * x0 + v1, m1[0] * x1 + u1, m1[3] * x1 + v1, \
+            m2[0] * x0 + u2, m2[3] * x0 + v2, m2[0] * x1 + u2, m2[3] * x1 + v2};
+        bool inside = true;
+        for(int k = 0; k < 8; k += 2)
+            inside = inside && ends[k] >= 0 && ends[k] < maxX && ends[k+1] >= 0 && ends[k+1] < maxY;
+
+        float s1[3], s2[3];
+        for(int x = x0; x <= x1; x++) {
+            if(inside) {
+                bilinearInside(base1, step1, m1[0] * x + u1, m1[3] * x + v1, s1);
+                bilinearInside(base2, step2, m2[0] * x + u2, m2[3] * x + v2, s2);
+            }
+            else {
+                bilinear(img1_, m1[0] * x + u1, m1[3] * x + v1, s1);
+                bilinear(img2_, m2[0] * x + u2, m2[3] * x + v2, s2);
+            }
+            d[3*x] = a * s1[0] + b * s2[0];
+            d[3*x+1] = a * s1[1] + b * s2[1];
+            d[3*x+2] = a * s1[2] + b * s2[2];
+        }
+    }
+}
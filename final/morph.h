@@ -0,0 +1,68 @@
+#ifndef MORPH_H
+#define MORPH_H
+
+#include <array>
+#include <vector>
+#include <opencv2/opencv.hpp>
+
+// side of the square screen tiles render() draws in parallel
+#define MESH_TILE 64
+
+// One triangle of the mesh: point indices, and for the current alpha its
+// morphed corners in fixed point and the affine maps from a morphed pixel
+// to its position in both sources.
+struct MeshTriangle {
+    int v[3];
+    bool empty;                 // no area at this alpha
+    bool owns[3];               // edge k of the corners below owns its pixel centers
+    long long X[3], Y[3];       // corners, fixed point (MESH_SUBPIXEL)
+    float m1[6], m2[6];         // (x, y) -> (m[0]x+m[1]y+m[2], m[3]x+m[4]y+m[5])
+};
+
+// Piecewise affine morph of two images over a shared triangle mesh.
+// init() keeps the sources and the mesh; setAlpha() computes the morphed
+// corners and both affine maps of every triangle once; render() then
+// rasterizes each triangle by scanline and writes the blend of both
+// sources, sampled bilinearly, to the pixels it covers. Nothing is
+// allocated after the first render() into the same output.
+// Pixels belong to the triangles containing their centers, with exact
+// integer edge tests and a top-left tie rule for centers on edges and
+// corners, so no pixel is drawn twice and there are no seams. Centers on
+// the outline are drawn on its left and top edges; corners on the last
+// column or row of the image are moved out by a subpixel step, so when the
+// mesh spans the image, as with the border points of the morph tool,
+// every pixel is drawn exactly once (morph_check tests this).
+// As no pixel has two owners, the triangles can be drawn in any order:
+// setAlpha() also bins them into screen tiles, and render() draws the
+// tiles in parallel, each clipped to its tile, with the same result as
+// drawing the whole mesh serially.
+class MeshMorph {
+public:
+    // img1, img2: CV_32FC3 of one size, kept by reference; triangles as
+    // indices into points1/points2
+    void init(const cv::Mat &img1, const cv::Mat &img2, const std::vector<cv::Point2f> &points1, \
+        const std::vector<cv::Point2f> &points2, const std::vector<std::array<int, 3> > &triangles);
+    void setAlpha(double alpha);
+    // dst is allocated (and cleared) when it does not have the source size
+    // and type; pixels outside the mesh keep their values. Serial when
+    // called from threads that already share the work, e.g. one per frame.
+    void render(cv::Mat &dst, bool parallel = true) const;
+    // the triangles of tile i (row-major) clipped to it; render() runs these
+    void drawTile(int i, cv::Mat &dst) const;
+    int tileCount() const { return (int)tiles_.size(); }
+    // how many triangles draw each pixel, CV_8U of the source size: 1 inside
+    // the mesh and 0 outside, a check of the ownership rules
+    void coverage(cv::Mat &count) const;
+
+private:
+    void drawTriangle(const MeshTriangle &t, const cv::Rect &clip, cv::Mat &dst) const;
+
+    cv::Mat img1_, img2_;
+    std::vector<cv::Point2f> points1_, points2_, points_;
+    std::vector<MeshTriangle> triangles_;
+    std::vector<std::vector<int> > tiles_;  // triangles overlapping each tile
+    int tilesX_;
+    float alpha_;
+};
+
+#endif
@@ -0,0 +1,134 @@
+// Checks the rasterization of MeshMorph on random meshes: every pixel of
+// the image is drawn by exactly one triangle, and the parallel render() is
+// bit for bit the serial one.
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+#include <array>
+#include <opencv2/opencv.hpp>
+#include "morph.h"
+
+using namespace std;
+using namespace cv;
+
+static void usage() {
+    printf("usage: morph_check [--meshes N] [--seed S]\n");
+    printf("--meshes N: random meshes to check (default: 300)\n");
+    printf("--seed S: seed of the meshes (default: 1)\n");
+}
+
+// A jittered grid of gx x gy cells over the image; the caller splits each
+// cell along a random diagonal, so border points have fans of one to many
+// triangles. Points move by up to 0.2 cells, so every cell stays convex
+// and neither diagonal folds the mesh, at any alpha. Corners stay put and
+// the other border points slide along their edge, so the outline is the
+// image rectangle, as with the border points of the morph tool. With
+// whole, points are rounded to pixel centers, where the tie rules matter.
+static void jitteredGrid(RNG &rng, Size size, int gx, int gy, bool whole, std::vector<Point2f> &points)
+{
+    float cw = (size.width - 1) / (float)gx, ch = (size.height - 1) / (float)gy;
+    points.clear();
+    for(int j = 0; j <= gy; j++)
+        for(int i = 0; i <= gx; i++) {
+            float x = i * cw, y = j * ch;
+            if(i > 0 && i < gx)
+                x += rng.uniform(-0.2f, 0.2f) * cw;
+            if(j > 0 && j < gy)
+                y += rng.uniform(-0.2f, 0.2f) * ch;
+            if(whole) {
+                x = (float)cvRound(x);
+                y = (float)cvRound(y);
+            }
+            // exact border coordinates, as findLandmarks() adds them
+            if(i == gx)
+                x = (float)(size.width - 1);
+            if(j == gy)
+                y = (float)(size.height - 1);
+            points.push_back(Point2f(x, y));
+        }
+}
+
+int main(int argc, char** argv)
+{
+    int meshes = 300;
+    unsigned seed = 1;
+    for(int a = 1; a < argc; a++) {
+        if(!strcmp(argv[a], "--meshes") && a+1 < argc)
+            meshes = atoi(argv[++a]);
+        else if(!strcmp(argv[a], "--seed") && a+1 < argc)
+            seed = (unsigned)atoi(argv[++a]);
+        else {
+            usage();
+            return -1;
+        }
+    }
+
+    RNG rng(seed);
+    int failed = 0;
+    long long pixels = 0;
+    for(int m = 0; m < meshes; m++) {
+        Size size(rng.uniform(16, 400), rng.uniform(16, 400));
+        int gx = rng.uniform(1, 9), gy = rng.uniform(1, 9);
+
+        bool whole = m % 2 == 1;
+        std::vector<Point2f> points1, points2;
+        jitteredGrid(rng, size, gx, gy, whole, points1);
+        jitteredGrid(rng, size, gx, gy, whole, points2);
+        std::vector<std::array<int, 3> > triangles;
+        for(int j = 0; j < gy; j++)
+            for(int i = 0; i < gx; i++) {
+                int p00 = j * (gx + 1) + i, p10 = p00 + 1, p01 = p00 + gx + 1, p11 = p01 + 1;
+                std::array<int, 3> t1, t2;
+                if(rng.uniform(0, 2)) {
+                    t1 = {{p00, p10, p11}};
+                    t2 = {{p00, p11, p01}};
+                }
+                else {
+                    t1 = {{p00, p10, p01}};
+                    t2 = {{p10, p11, p01}};
+                }
+                triangles.push_back(t1);
+                triangles.push_back(t2);
+            }
+
+        Mat img1(size, CV_32FC3), img2(size, CV_32FC3);
+        rng.fill(img1, RNG::UNIFORM, 0, 255);
+        rng.fill(img2, RNG::UNIFORM, 0, 255);
+        MeshMorph mesh;
+        mesh.init(img1, img2, points1, points2, triangles);
+
+        const double alphas[] = {0, rng.uniform(0.0, 1.0), 1};
+        for(int k = 0; k < 3; k++) {
+            mesh.setAlpha(alphas[k]);
+
+            Mat count;
+            mesh.coverage(count);
+            int holes = 0, overlaps = 0;
+            for(int y = 0; y < size.height; y++) {
+                const uchar *c = count.ptr<uchar>(y);
+                for(int x = 0; x < size.width; x++) {
+                    holes += c[x] == 0;
+                    overlaps += c[x] > 1;
+                }
+            }
+
+            Mat serial, parallel;
+            mesh.render(serial, false);
+            mesh.render(parallel, true);
+            int rows = 0;
+            for(int y = 0; y < size.height; y++)
+                rows += memcmp(serial.ptr<float>(y), parallel.ptr<float>(y), size.width * 3 * sizeof(float)) != 0;
+
+            pixels += size.area();
+            if(holes || overlaps || rows) {
+                printf("mesh %d (%dx%d, %dx%d cells) alpha %.3f: %d holes, %d pixels drawn twice or more, " \
+                    "%d rows differ in parallel\n", m, size.width, size.height, gx, gy, alphas[k], holes, overlaps, rows);
+                failed++;
+            }
+        }
+    }
+    printf("%d meshes, %d alphas each, %lld pixels: %d failed\n", meshes, 3, pixels, failed);
+    return failed ? -1 : 0;
+}